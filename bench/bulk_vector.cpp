@@ -0,0 +1,79 @@
+#include "serialize_binary.h"
+#include <algorithm>
+#include <chrono>
+#include <cstdlib>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <string>
+#include <vector>
+
+// round trip of a large std::vector<double>: the block path of binarySerialize and
+// binaryDeserialize against writing and reading one element per call, which is what
+// they did before. Both files must come out byte for byte identical
+
+namespace {
+    double millis(std::chrono::steady_clock::time_point from) {
+        return std::chrono::duration<double, std::milli>(std::chrono::steady_clock::now() - from).count();
+    }
+
+    void writeElementwise(const std::vector<double> &value, const std::string &filename) {
+        std::ofstream ofs(filename, std::ios::binary | std::ios::trunc);
+        size_t size = value.size();
+        ofs.write(reinterpret_cast<const char *>(&size), sizeof(size));
+        for (const double &item : value) ofs.write(reinterpret_cast<const char *>(&item), sizeof(item));
+    }
+
+    void readElementwise(std::vector<double> &value, const std::string &filename) {
+        std::ifstream ifs(filename, std::ios::binary);
+        size_t size = 0;
+        ifs.read(reinterpret_cast<char *>(&size), sizeof(size));
+        for (size_t i = 0; i < size; i++) {
+            double item;
+            ifs.read(reinterpret_cast<char *>(&item), sizeof(item));
+            value.push_back(item);
+        }
+    }
+
+    bool sameBytes(const std::string &a, const std::string &b) {
+        std::ifstream fa(a, std::ios::binary), fb(b, std::ios::binary);
+        return std::equal(std::istreambuf_iterator<char>(fa), std::istreambuf_iterator<char>(),
+                          std::istreambuf_iterator<char>(fb), std::istreambuf_iterator<char>());
+    }
+}
+
+int main(int argc, char **argv) {
+    size_t count = argc > 1 ? std::strtoull(argv[1], nullptr, 10) : 20000000;
+    std::vector<double> value(count);
+    for (size_t i = 0; i < count; i++) value[i] = i * 0.5;
+
+    std::string dir = std::filesystem::temp_directory_path().string();
+    std::string blockFile = dir + "/bulk_vector_block.dat";
+    std::string elementFile = dir + "/bulk_vector_element.dat";
+
+    auto start = std::chrono::steady_clock::now();
+    writeElementwise(value, elementFile);
+    double elementWriteMs = millis(start);
+    std::vector<double> elementRead;
+    start = std::chrono::steady_clock::now();
+    readElementwise(elementRead, elementFile);
+    double elementReadMs = millis(start);
+
+    start = std::chrono::steady_clock::now();
+    binary::binarySerialize(value, blockFile);
+    double blockWriteMs = millis(start);
+    std::vector<double> blockRead;
+    start = std::chrono::steady_clock::now();
+    binary::binaryDeserialize(blockRead, blockFile);
+    double blockReadMs = millis(start);
+
+    bool ok = sameBytes(blockFile, elementFile) && blockRead == value && elementRead == value;
+    std::filesystem::remove(blockFile);
+    std::filesystem::remove(elementFile);
+
+    std::cout << "std::vector<double> x " << count << std::endl;
+    std::cout << "per element  write: " << elementWriteMs << " ms, read: " << elementReadMs << " ms" << std::endl;
+    std::cout << "block        write: " << blockWriteMs << " ms, read: " << blockReadMs << " ms" << std::endl;
+    std::cout << "identical: " << (ok ? "yes" : "no") << std::endl;
+    return ok ? 0 : 1;
+}
@@ -0,0 +1,311 @@
+#ifndef BINARY_IO_H
+#define BINARY_IO_H
+
+#include <cstddef>
+#include <cstdint>
+#include <cstring>
+#include <concepts>
+#include <condition_variable>
+#include <ios>
+#include <memory>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+namespace binary {
+    // anything with ostream-like write(const char *, n), e.g. std::ofstream or Buffer
+    template <class O>
+    concept Sink = requires(O &o, const char *data, std::streamsize size) {
+        o.write(data, size);
+    };
+
+    // anything with istream-like read(char *, n), e.g. std::ifstream or BufferReader
+    template <class I>
+    concept Source = requires(I &i, char *data, std::streamsize size) {
+        i.read(data, size);
+    };
+
+    // sources that can hand out pointers into their own storage, e.g. a BufferReader
+    // over a MappedFile
+    template <class I>
+    concept ViewSource = Source<I> && requires(I &i, size_t size) {
+        { i.view(size, size) } -> std::same_as<const std::byte *>;
+    };
+
+    // wire format policies; a sink or source carries one as its nested format type,
+    // otherwise it uses Fixed
+    struct Fixed {
+        static constexpr bool varint = false;  // LEB128 lengths, zigzag varint integers
+        static constexpr bool packed = false;  // delta-coded, bit-packed integral set/map keys
+        static constexpr bool overwrite = false;  // decode replaces contents instead of appending
+        static constexpr bool columnar = false;  // vectors of user-defined classes stored field by field
+        static constexpr bool framed = false;  // fields of user-defined classes prefixed with their length
+    };
+
+    struct Compact : Fixed {
+        static constexpr bool varint = true;
+    };
+
+    struct Packed : Fixed {
+        static constexpr bool packed = true;
+    };
+
+    struct CompactPacked : Compact {
+        static constexpr bool packed = true;
+    };
+
+    // combine with packed for delta-coded integer columns, e.g.
+    // struct Analytics : binary::CompactPacked { static constexpr bool columnar = true; };
+    struct Columnar : Fixed {
+        static constexpr bool columnar = true;
+    };
+
+    // lets binaryDeserializeFields step over unselected fields without parsing them
+    struct Framed : Fixed {
+        static constexpr bool framed = true;
+    };
+
+    // decode-side only: containers are overwritten in place, reusing their elements,
+    // nodes and string capacity, e.g. binaryDeserialize<binary::Overwrite<>>(value, filename)
+    template <class F = Fixed>
+    struct Overwrite : F {
+        static constexpr bool overwrite = true;
+    };
+
+    template <class S>
+    struct format_of {
+        using type = Fixed;
+    };
+
+    template <class S> requires requires { typename S::format; }
+    struct format_of<S> {
+        using type = typename S::format;
+    };
+
+    template <class S>
+    using format_t = typename format_of<std::remove_cvref_t<S>>::type;
+
+    // borrows a sink or source and tags it with format F
+    template <class S, class F>
+    class Formatted {
+    public:
+        using format = F;
+
+        explicit Formatted(S &inner) : inner_(inner) {}
+
+        void write(const char *data, std::streamsize size) requires Sink<S> {
+            inner_.write(data, size);
+        }
+
+        void read(char *data, std::streamsize size) requires Source<S> {
+            inner_.read(data, size);
+        }
+
+        const std::byte *view(size_t size, size_t align = 1) requires ViewSource<S> {
+            return inner_.view(size, align);
+        }
+
+        size_t remaining() const requires requires(const S &s) { s.remaining(); } {
+            return inner_.remaining();
+        }
+
+        S &inner() { return inner_; }
+
+    private:
+        S &inner_;
+    };
+
+    // growable in-memory sink
+    class Buffer {
+    public:
+        Buffer() = default;
+        explicit Buffer(size_t capacity) { bytes_.reserve(capacity); }
+
+        void write(const char *data, std::streamsize size) {
+            const std::byte *first = reinterpret_cast<const std::byte *>(data);
+            bytes_.insert(bytes_.end(), first, first + size);
+        }
+
+        void reserve(size_t capacity) { bytes_.reserve(capacity); }
+        void clear() { bytes_.clear(); }
+        size_t size() const { return bytes_.size(); }
+        size_t capacity() const { return bytes_.capacity(); }
+        const std::byte *data() const { return bytes_.data(); }
+        std::span<const std::byte> bytes() const { return bytes_; }
+        std::vector<std::byte> release() { return std::move(bytes_); }
+
+    private:
+        std::vector<std::byte> bytes_;
+    };
+
+    // sink that only counts, used to size a Buffer before encoding into it
+    class SizeCounter {
+    public:
+        void write(const char *, std::streamsize size) { size_ += size; }
+        size_t size() const { return size_; }
+
+    private:
+        size_t size_ = 0;
+    };
+
+    // forwards to another sink and counts the bytes written through it
+    template <class S>
+    class Counted {
+    public:
+        explicit Counted(S &inner) : inner_(inner) {}
+
+        void write(const char *data, std::streamsize size) {
+            inner_.write(data, size);
+            size_ += size;
+        }
+
+        size_t size() const { return size_; }
+
+    private:
+        S &inner_;
+        size_t size_ = 0;
+    };
+
+    // source over borrowed bytes; reading past the end sets the fail flag and reads nothing
+    class BufferReader {
+    public:
+        explicit BufferReader(std::span<const std::byte> bytes) : bytes_(bytes) {}
+
+        void read(char *data, std::streamsize size) {
+            if (size == 0) return;
+            const std::byte *bytes = view(size);
+            if (bytes != nullptr) std::memcpy(data, bytes, size);
+        }
+
+        // borrows the next size bytes instead of copying them; returns nullptr and sets
+        // the fail flag if they run past the end or do not start on an align boundary
+        const std::byte *view(size_t size, size_t align = 1) {
+            const std::byte *bytes = bytes_.data() + pos_;
+            if (fail_ || size > bytes_.size() - pos_ || reinterpret_cast<uintptr_t>(bytes) % align != 0) {
+                fail_ = true;
+                pos_ = bytes_.size();
+                return nullptr;
+            }
+            pos_ += size;
+            return bytes;
+        }
+
+        bool fail() const { return fail_; }
+        explicit operator bool() const { return !fail_; }
+        size_t tell() const { return pos_; }
+        size_t remaining() const { return bytes_.size() - pos_; }
+
+    private:
+        std::span<const std::byte> bytes_;
+        size_t pos_ = 0;
+        bool fail_ = false;
+    };
+
+    struct FdOptions {
+        size_t bufferSize = 1 << 20;    // user-space buffer for small writes
+        size_t passthrough = 64 << 10;  // writes at least this large bypass the buffer
+    };
+
+    // file sink on a raw descriptor: small writes are coalesced into a large buffer,
+    // large payloads are handed to writev together with the pending buffer instead of
+    // being copied into it
+    class FdSink {
+    public:
+        explicit FdSink(const std::string &filename, FdOptions options = {});
+        ~FdSink();
+        FdSink(const FdSink &) = delete;
+        FdSink &operator=(const FdSink &) = delete;
+
+        void write(const char *data, std::streamsize size);
+        bool flush();
+        bool sync();   // flush, then fdatasync
+        bool close();
+
+        bool fail() const { return fail_; }
+        explicit operator bool() const { return fd_ >= 0 && !fail_; }
+
+    private:
+        bool writeAll(const char *data, size_t size);
+
+        int fd_ = -1;
+        bool fail_ = false;
+        FdOptions options_;
+        std::unique_ptr<char[]> buffer_;
+        size_t used_ = 0;
+    };
+
+    struct StreamOptions {
+        size_t bufferSize = 1 << 20;  // bytes held per block; memory stays at two blocks
+        bool readAhead = true;        // read the next block on a helper thread while this one is decoded
+    };
+
+    // file source that reads through a fixed-size block, so memory stays bounded however
+    // large the file is; reading past the end sets the fail flag
+    class FdSource {
+    public:
+        explicit FdSource(const std::string &filename, StreamOptions options = {});
+        ~FdSource();
+        FdSource(const FdSource &) = delete;
+        FdSource &operator=(const FdSource &) = delete;
+
+        void read(char *data, std::streamsize size);
+
+        // true once every byte of the file has been read. False after a read error, so
+        // the caller's next read fails instead of the error passing for the end of file
+        bool atEnd();
+
+        bool fail() const { return fail_; }
+        explicit operator bool() const { return fd_ >= 0 && !fail_; }
+
+    private:
+        bool refill();
+        void readAhead();
+
+        int fd_ = -1;
+        bool fail_ = false;
+        StreamOptions options_;
+        std::unique_ptr<char[]> current_;
+        std::unique_ptr<char[]> next_;
+        size_t pos_ = 0;
+        size_t size_ = 0;
+
+        // one helper thread for the life of the source, filling next_ on request
+        std::thread reader_;
+        std::mutex mutex_;
+        std::condition_variable changed_;
+        bool requested_ = false;  // next_ is being filled, or is filled and not yet taken
+        bool ready_ = false;
+        bool stop_ = false;
+        long got_ = 0;            // what the last fill returned
+    };
+
+    struct MmapOptions {
+        bool sequential = true;  // MADV_SEQUENTIAL, otherwise MADV_RANDOM
+        bool willNeed = true;    // MADV_WILLNEED: start readahead of the whole file now
+    };
+
+    // read-only private mapping of a whole file; views decoded from a BufferReader over
+    // bytes() stay valid for the lifetime of the MappedFile
+    class MappedFile {
+    public:
+        explicit MappedFile(const std::string &filename, MmapOptions options = {});
+        ~MappedFile();
+        MappedFile(const MappedFile &) = delete;
+        MappedFile &operator=(const MappedFile &) = delete;
+
+        std::span<const std::byte> bytes() const { return {data_, size_}; }
+        size_t size() const { return size_; }
+        bool fail() const { return fail_; }
+        explicit operator bool() const { return !fail_; }
+
+    private:
+        const std::byte *data_ = nullptr;
+        size_t size_ = 0;
+        bool fail_ = false;
+    };
+}
+
+#endif // !BINARY_IO_H
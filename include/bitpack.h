@@ -0,0 +1,56 @@
+#ifndef BITPACK_H
+#define BITPACK_H
+
+#include <bit>
+#include <cstddef>
+#include <cstdint>
+
+// fixed-width bit packing of unsigned integers, used for delta-coded sorted keys.
+// values are laid out LSB-first in little-endian 64-bit words. The loops run over a fixed
+// block with one data-dependent branch, taken when a value straddles two words
+namespace binary::bitpack {
+    constexpr size_t BLOCK = 128;
+
+    // bits needed for the largest of n values
+    inline int width(const uint64_t *values, size_t n) {
+        uint64_t bits = 0;
+        for (size_t i = 0; i < n; i++) bits |= values[i];
+        return 64 - std::countl_zero(bits);
+    }
+
+    inline size_t words(size_t n, int bits) {
+        return (n * bits + 63) / 64;
+    }
+
+    // packs n values of the given width into words(n, bits) words of out
+    inline void pack(const uint64_t *values, size_t n, int bits, uint64_t *out) {
+        size_t count = words(n, bits);
+        for (size_t i = 0; i < count; i++) out[i] = 0;
+        if (bits == 0) return;
+        for (size_t i = 0; i < n; i++) {
+            size_t bit = i * bits;
+            size_t word = bit / 64;
+            int shift = bit % 64;
+            out[word] |= values[i] << shift;
+            if (shift + bits > 64) out[word + 1] |= values[i] >> (64 - shift);
+        }
+    }
+
+    inline void unpack(const uint64_t *in, size_t n, int bits, uint64_t *values) {
+        if (bits == 0) {
+            for (size_t i = 0; i < n; i++) values[i] = 0;
+            return;
+        }
+        uint64_t mask = bits == 64 ? ~uint64_t(0) : (uint64_t(1) << bits) - 1;
+        for (size_t i = 0; i < n; i++) {
+            size_t bit = i * bits;
+            size_t word = bit / 64;
+            int shift = bit % 64;
+            uint64_t value = in[word] >> shift;
+            if (shift + bits > 64) value |= in[word + 1] << (64 - shift);
+            values[i] = value & mask;
+        }
+    }
+}
+
+#endif // !BITPACK_H
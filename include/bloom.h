@@ -0,0 +1,232 @@
+#ifndef BLOOM_H
+#define BLOOM_H
+
+#include "binary_io.h"
+#include "serialize_binary.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <span>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <vector>
+#include <sys/stat.h>
+
+// split-block Bloom filter over the keys of a std::set / std::map file, kept next to it
+// as filename + ".bloom". Every key sets one bit in each of the eight 32-bit words of a
+// single 32-byte block, so a probe touches one cache line whatever the filter size:
+//   blocks, 32 bytes each
+//   block count, key count, size and modification time (ns) of the data file when the
+//     filter was built, and BLOOM_MAGIC, u64 each
+// A filter whose data file has since been rewritten is ignored rather than trusted. At
+// the default 10 bits per key about 1% of absent keys are reported as maybe present.
+namespace binary {
+    constexpr uint64_t BLOOM_MAGIC = 0x324D4F4F4C425342;  // "BSBLOOM2"
+    constexpr size_t BLOOM_TRAILER = 5 * sizeof(uint64_t);
+
+    struct BloomOptions {
+        double bitsPerKey = 10;
+    };
+
+    // numbers hash by value, so a std::set<double> filter answers queries made with int
+    // and -0.0 finds 0.0; strings hash by their bytes
+    template <class K>
+    concept BloomKey = Arithmetic<K> || std::is_convertible_v<const K &, std::string_view>;
+
+    namespace bloom {
+        constexpr size_t WORDS = 8;
+        constexpr uint32_t SALT[WORDS] = {0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+                                          0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U};
+
+        inline uint64_t mix(uint64_t x) {
+            x ^= x >> 30;
+            x *= 0xbf58476d1ce4e5b9ULL;
+            x ^= x >> 27;
+            x *= 0x94d049bb133111ebULL;
+            return x ^ (x >> 31);
+        }
+
+        // keys that compare equal hash equally: integral-valued floating point numbers,
+        // -0.0 included, hash as the integer they equal, any other as its double
+        template <BloomKey K>
+        uint64_t hash(const K &key) {
+            if constexpr (std::is_integral_v<K>) {
+                return mix(static_cast<uint64_t>(key));
+            } else if constexpr (std::is_floating_point_v<K>) {
+                double value = static_cast<double>(key);
+                if (value >= -0x1p63 && value < 0x1p63 && value == std::trunc(value)) {
+                    return mix(static_cast<uint64_t>(static_cast<int64_t>(value)));
+                }
+                uint64_t bits;
+                std::memcpy(&bits, &value, sizeof(bits));
+                return mix(bits);
+            } else {
+                std::string_view bytes = key;
+                uint64_t h = 0xcbf29ce484222325ULL;  // FNV-1a
+                for (char c : bytes) h = (h ^ static_cast<unsigned char>(c)) * 0x100000001b3ULL;
+                return mix(h);
+            }
+        }
+
+        // the upper half picks the block, the lower half the bit in each word
+        inline size_t block(uint64_t hash, size_t blocks) {
+            return static_cast<size_t>(((hash >> 32) * blocks) >> 32);
+        }
+
+        inline uint32_t bit(uint64_t hash, size_t word) {
+            return uint32_t(1) << ((static_cast<uint32_t>(hash) * SALT[word]) >> 27);
+        }
+
+        // size and modification time of the data file, which tie a filter to its contents
+        inline bool stamp(const std::string &filename, uint64_t &size, uint64_t &modified) {
+            struct stat status;
+            if (::stat(filename.c_str(), &status) != 0) return false;
+            size = static_cast<uint64_t>(status.st_size);
+            modified = static_cast<uint64_t>(status.st_mtim.tv_sec) * 1000000000 + status.st_mtim.tv_nsec;
+            return true;
+        }
+    }
+
+    class BloomBuilder {
+    public:
+        explicit BloomBuilder(size_t keys, BloomOptions options = {})
+            : blocks_(std::max<size_t>(1, static_cast<size_t>(std::ceil(keys * options.bitsPerKey / 256)))),
+              words_(blocks_ * bloom::WORDS) {}
+
+        template <BloomKey K>
+        void insert(const K &key) {
+            uint64_t hash = bloom::hash(key);
+            uint32_t *block = words_.data() + bloom::block(hash, blocks_) * bloom::WORDS;
+            for (size_t i = 0; i < bloom::WORDS; i++) block[i] |= bloom::bit(hash, i);
+            keys_++;
+        }
+
+        // writes the sidecar of filename, which must already hold the keys inserted
+        bool write(const std::string &filename) const {
+            uint64_t size, modified;
+            FdSink sink(filename + ".bloom");
+            if (!sink || !bloom::stamp(filename, size, modified)) {
+                std::cerr << "Error opening file when serilization." << std::endl;
+                return false;
+            }
+            uint64_t trailer[] = {blocks_, keys_, size, modified, BLOOM_MAGIC};
+            sink.write(reinterpret_cast<const char *>(words_.data()), words_.size() * sizeof(uint32_t));
+            sink.write(reinterpret_cast<const char *>(trailer), sizeof(trailer));
+            if (!sink.close()) {
+                std::cerr << "Error writing file when serilization." << std::endl;
+                return false;
+            }
+            return true;
+        }
+
+    private:
+        size_t blocks_;
+        size_t keys_ = 0;
+        std::vector<uint32_t> words_;
+    };
+
+    // maps the sidecar of filename; with none, a damaged one or one older than the file,
+    // every key may be present
+    class BloomFilter {
+    public:
+        explicit BloomFilter(const std::string &filename)
+            : file_(std::make_unique<MappedFile>(filename + ".bloom", MmapOptions{false, false})) {
+            std::span<const std::byte> bytes = file_->bytes();
+            uint64_t trailer[5], size, modified;
+            if (file_->fail() || bytes.size() < BLOOM_TRAILER) return;
+            std::memcpy(trailer, bytes.data() + bytes.size() - BLOOM_TRAILER, BLOOM_TRAILER);
+            if (trailer[4] != BLOOM_MAGIC || trailer[0] == 0 ||
+                trailer[0] != (bytes.size() - BLOOM_TRAILER) / (bloom::WORDS * sizeof(uint32_t))) {
+                std::cerr << "Error reading index when deserilization." << std::endl;
+                return;
+            }
+            if (!bloom::stamp(filename, size, modified) || trailer[2] != size || trailer[3] != modified) {
+                std::cerr << "Error reading index when deserilization." << std::endl;
+                return;
+            }
+            words_ = reinterpret_cast<const uint32_t *>(bytes.data());
+            blocks_ = trailer[0];
+            keys_ = trailer[1];
+        }
+
+        bool fail() const { return words_ == nullptr; }
+        explicit operator bool() const { return !fail(); }
+        size_t size() const { return keys_; }
+
+        // false only if key is definitely not in the file
+        template <BloomKey K>
+        bool mayContain(const K &key) const {
+            if (words_ == nullptr) return true;
+            uint64_t hash = bloom::hash(key);
+            const uint32_t *block = words_ + bloom::block(hash, blocks_) * bloom::WORDS;
+            bool present = true;
+            for (size_t i = 0; i < bloom::WORDS; i++) present &= (block[i] & bloom::bit(hash, i)) != 0;
+            return present;
+        }
+
+    private:
+        std::unique_ptr<MappedFile> file_;
+        const uint32_t *words_ = nullptr;
+        size_t blocks_ = 0;
+        size_t keys_ = 0;
+    };
+
+    template <class C>
+    bool writeBloom(const C &value, const std::string &filename, BloomOptions options = {}) {
+        BloomBuilder builder(value.size(), options);
+        for (const auto &item : value) {
+            if constexpr (requires { typename C::mapped_type; }) {
+                builder.insert(item.first);
+            } else {
+                builder.insert(item);
+            }
+        }
+        return builder.write(filename);
+    }
+
+    // rebuilds the filter of a file written with format F, reading its keys in a single
+    // streaming pass: packed keys are all read before any value, plain ones have their
+    // values skipped
+    template <class C, class F = Fixed>
+    bool binaryRebuildBloom(const std::string &filename, BloomOptions options = {}, StreamOptions stream = {}) {
+        using K = typename C::key_type;
+        FdSource source(filename, stream);
+        if (!source) {
+            std::cerr << "Error opening file when deserilization." << std::endl;
+            return false;
+        }
+        Formatted<FdSource, F> in(source);
+        size_t size = readSize(in);
+        BloomBuilder builder(size, options);
+        if constexpr (F::packed && PackedKey<K>) {
+            deserializePackedKeys<K>(size, in, [&](K key) { builder.insert(key); });
+        } else {
+            K key{};
+            for (size_t i = 0; i < size && !source.fail(); i++) {
+                deserialize(key, in);
+                builder.insert(key);
+                if constexpr (requires { typename C::mapped_type; }) skip<typename C::mapped_type>(in);
+            }
+        }
+        if (source.fail()) {
+            std::cerr << "Error reading file when deserilization." << std::endl;
+            return false;
+        }
+        return builder.write(filename);
+    }
+
+    // binarySerialize followed by the key filter, for std::set and std::map. The keys are
+    // read back from the file just written: a sequential pass over it is far cheaper than
+    // walking the tree's nodes a second time
+    template<class F = Fixed, class T> requires requires { typename T::key_type; }
+    void binarySerialize(const T &value, std::string &filename, const BloomOptions &options) {
+        binarySerialize<F>(value, filename);
+        binaryRebuildBloom<T, F>(filename, options);
+    }
+}
+
+#endif // !BLOOM_H
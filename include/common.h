@@ -1,39 +1,204 @@
 #ifndef COMMON_H
 #define COMMON_H
 
+#include <algorithm>
+#include <cstddef>
+#include <initializer_list>
 #include <iostream>
 #include <fstream>
+#include <string_view>
+#include <tuple>
+#include <type_traits>
 
 #define MAKE_TUPLE(...) \
     auto to_tuple() const { \
         return std::tie(__VA_ARGS__); \
     }
 
-#define GENERATE_SERIALIZATION(Class, ...)                                        \
+// SERIALIZATION_FOR_EACH(m, arg, a, b, c) expands to m(arg, a) m(arg, b) m(arg, c), up to 256 items
+#define SERIALIZATION_PARENS ()
+#define SERIALIZATION_EXPAND(...) SERIALIZATION_EXPAND3(SERIALIZATION_EXPAND3(SERIALIZATION_EXPAND3(SERIALIZATION_EXPAND3(__VA_ARGS__))))
+#define SERIALIZATION_EXPAND3(...) SERIALIZATION_EXPAND2(SERIALIZATION_EXPAND2(SERIALIZATION_EXPAND2(SERIALIZATION_EXPAND2(__VA_ARGS__))))
+#define SERIALIZATION_EXPAND2(...) SERIALIZATION_EXPAND1(SERIALIZATION_EXPAND1(SERIALIZATION_EXPAND1(SERIALIZATION_EXPAND1(__VA_ARGS__))))
+#define SERIALIZATION_EXPAND1(...) __VA_ARGS__
+#define SERIALIZATION_FOR_EACH(macro, arg, ...) \
+    __VA_OPT__(SERIALIZATION_EXPAND(SERIALIZATION_FOR_EACH_HELPER(macro, arg, __VA_ARGS__)))
+#define SERIALIZATION_FOR_EACH_HELPER(macro, arg, first, ...) \
+    macro(arg, first) __VA_OPT__(SERIALIZATION_FOR_EACH_AGAIN SERIALIZATION_PARENS (macro, arg, __VA_ARGS__))
+#define SERIALIZATION_FOR_EACH_AGAIN() SERIALIZATION_FOR_EACH_HELPER
+
+#define SERIALIZATION_OFFSET(Class, field) offsetof(Class, field),
+#define SERIALIZATION_SIZE(Class, field) sizeof(Class::field),
+#define SERIALIZATION_SIZE_SUM(Class, field) sizeof(Class::field) +
+#define SERIALIZATION_NAME(Class, field) #field,
+#define SERIALIZATION_BULK(Class, field) binary::is_bulk_copyable<std::remove_cv_t<decltype(Class::field)>>::value &&
+
+// positional layout: fields are written back to back in listing order
+#define GENERATE_SERIALIZATION(Class, ...) \
+    GENERATE_SERIALIZATION_LAYOUT(Class, false, __VA_ARGS__)
+
+// tagged layout: a field count, then each field as its tag (1-based listing position),
+// its byte length and its value. Readers skip tags they do not know and leave fields
+// missing from the data untouched, so fields may be appended to the listing without
+// breaking old files or old readers; retired fields must keep their place
+#define GENERATE_TAGGED_SERIALIZATION(Class, ...) \
+    GENERATE_SERIALIZATION_LAYOUT(Class, true, __VA_ARGS__)
+
+#define GENERATE_SERIALIZATION_LAYOUT(Class, Tagged, ...)                         \
     friend void binarySerialize(const Class& obj, const std::string& filename) {        \
         obj.binarySerialize(filename);                                                  \
     }                                                                             \
+    friend void binarySerialize(const Class& obj, const std::string& filename,    \
+                                const binary::FdOptions& options) {               \
+        obj.binarySerialize(filename, options);                                   \
+    }                                                                             \
     friend void binaryDeserialize(Class& obj, const std::string& filename) {            \
         obj.binaryDeserialize(filename);                                                \
     }                                                                             \
+    friend void binaryDeserializeFields(Class& obj, const std::string& filename,  \
+                                        std::initializer_list<std::string_view> fields) { \
+        obj.binaryDeserializeFields(filename, fields);                            \
+    }                                                                             \
+    template <typename F = binary::Fixed>                                         \
     void binarySerialize(const std::string& filename) const {                           \
         std::ofstream ofs(filename, std::ios::binary);                            \
         if (!ofs) {                                                               \
             std::cerr << "Error opening file when serilization." << std::endl;    \
             return;                                                               \
         }                                                                         \
-        apply([&](const auto&... args) { serialize_impl(ofs, args...); });        \
+        binary::Formatted<std::ofstream, F> out(ofs);                             \
+        serializeTo(out);                                                         \
         ofs.close();                                                              \
     }                                                                             \
+    template <typename F = binary::Fixed>                                         \
+    void binarySerialize(const std::string& filename, const binary::FdOptions& options) const { \
+        binary::FdSink sink(filename, options);                                   \
+        if (!sink) {                                                              \
+            std::cerr << "Error opening file when serilization." << std::endl;    \
+            return;                                                               \
+        }                                                                         \
+        binary::Formatted<binary::FdSink, F> out(sink);                           \
+        serializeTo(out);                                                         \
+        if (!sink.close()) {                                                      \
+            std::cerr << "Error writing file when serilization." << std::endl;    \
+        }                                                                         \
+    }                                                                             \
+    template <typename F = binary::Fixed>                                         \
     void binaryDeserialize(const std::string& filename) {                               \
         std::ifstream ifs(filename, std::ios::binary);                            \
         if (!ifs) {                                                               \
             std::cerr << "Error opening file when deserilization." << std::endl;  \
             return;                                                               \
         }                                                                         \
-        apply([&](auto&... args) { deserialize_impl(ifs, args...); });            \
+        binary::Formatted<std::ifstream, F> in(ifs);                              \
+        deserializeFrom(in);                                                      \
         ifs.close();                                                              \
     }                                                                             \
+    /* decodes only the named fields and skips the rest, e.g.                      \
+       stu.binaryDeserializeFields<binary::Framed>(filename, {"d"}) */              \
+    template <typename F = binary::Fixed>                                         \
+    void binaryDeserializeFields(const std::string& filename,                     \
+                                 std::initializer_list<std::string_view> fields) { \
+        std::ifstream ifs(filename, std::ios::binary);                            \
+        if (!ifs) {                                                               \
+            std::cerr << "Error opening file when deserilization." << std::endl;  \
+            return;                                                               \
+        }                                                                         \
+        binary::Formatted<std::ifstream, F> in(ifs);                              \
+        deserializeFrom(in, fields);                                              \
+        ifs.close();                                                              \
+    }                                                                             \
+    static constexpr bool serialization_tagged() {                                \
+        return Tagged;                                                            \
+    }                                                                             \
+    static bool serialization_selected(std::initializer_list<std::string_view> fields, size_t index) { \
+        constexpr std::string_view names[] = {SERIALIZATION_FOR_EACH(SERIALIZATION_NAME, Class, __VA_ARGS__)}; \
+        return std::find(fields.begin(), fields.end(), names[index]) != fields.end(); \
+    }                                                                             \
+    /* true when the listed fields are bulk-copyable, in declaration order and fill  \
+       the object without padding, so its memory is exactly its serialized form */ \
+    template <typename C = Class>                                                 \
+    static constexpr bool serialization_packed() {                                \
+        if constexpr (Tagged || !std::is_trivially_copyable_v<C> || !std::is_standard_layout_v<C>) { \
+            return false;                                                         \
+        } else {                                                                  \
+            if (!(SERIALIZATION_FOR_EACH(SERIALIZATION_BULK, C, __VA_ARGS__) true)) return false; \
+            constexpr size_t offsets[] = {SERIALIZATION_FOR_EACH(SERIALIZATION_OFFSET, C, __VA_ARGS__)}; \
+            constexpr size_t sizes[] = {SERIALIZATION_FOR_EACH(SERIALIZATION_SIZE, C, __VA_ARGS__)}; \
+            size_t end = 0;                                                       \
+            for (size_t i = 0; i < sizeof(offsets) / sizeof(offsets[0]); i++) {   \
+                if (offsets[i] != end) return false;                              \
+                end += sizes[i];                                                  \
+            }                                                                     \
+            return end == sizeof(C);                                              \
+        }                                                                         \
+    }                                                                             \
+    template <typename C = Class>                                                 \
+    static void serialization_check_packed() {                                    \
+        static_assert(std::is_trivially_copyable_v<C>, "packed layout must be trivially copyable"); \
+        static_assert(sizeof(C) == (SERIALIZATION_FOR_EACH(SERIALIZATION_SIZE_SUM, C, __VA_ARGS__) 0), \
+                      "packed layout must not contain padding");                  \
+    }                                                                             \
+    template <typename O>                                                         \
+    void serializeTo(O& os) const {                                               \
+        if constexpr (serialization_packed() && !binary::format_t<O>::varint && !binary::format_t<O>::framed) { \
+            serialization_check_packed();                                         \
+            os.write(reinterpret_cast<const char *>(this), sizeof(Class));        \
+        } else if constexpr (Tagged) {                                            \
+            size_t tag = 0;                                                       \
+            apply([&](const auto&... args) {                                      \
+                binary::writeVarint(sizeof...(args), os);                         \
+                (binary::serializeField(args, os, ++tag), ...);                   \
+            });                                                                   \
+        } else {                                                                  \
+            apply([&](const auto&... args) { serialize_impl(os, args...); });     \
+        }                                                                         \
+    }                                                                             \
+    template <typename I>                                                         \
+    void deserializeFrom(I& is) {                                                 \
+        if constexpr (serialization_packed() && !binary::format_t<I>::varint && !binary::format_t<I>::framed) { \
+            serialization_check_packed();                                         \
+            is.read(reinterpret_cast<char *>(this), sizeof(Class));               \
+        } else if constexpr (Tagged) {                                            \
+            deserialize_tagged(is, [](size_t) { return true; });                  \
+        } else {                                                                  \
+            apply([&](auto&... args) { deserialize_impl(is, args...); });         \
+        }                                                                         \
+    }                                                                             \
+    template <typename I>                                                         \
+    void deserializeFrom(I& is, std::initializer_list<std::string_view> fields) { \
+        if constexpr (serialization_packed() && !binary::format_t<I>::varint && !binary::format_t<I>::framed) { \
+            is.read(reinterpret_cast<char *>(this), sizeof(Class));               \
+        } else if constexpr (Tagged) {                                            \
+            deserialize_tagged(is, [&](size_t index) { return serialization_selected(fields, index); }); \
+        } else {                                                                  \
+            size_t index = 0;                                                     \
+            apply([&](auto&... args) {                                            \
+                (binary::deserializeField(args, is, serialization_selected(fields, index++)), ...); \
+            });                                                                   \
+        }                                                                         \
+    }                                                                             \
+    template <typename I, typename Selected>                                      \
+    void deserialize_tagged(I& is, Selected selected) {                           \
+        uint64_t count = binary::readVarint(is);                                  \
+        for (uint64_t i = 0; i < count; i++) {                                    \
+            uint64_t tag = binary::readVarint(is);                                \
+            uint64_t size = binary::readVarint(is);                               \
+            bool decoded = false;                                                 \
+            uint64_t index = 0;                                                   \
+            apply([&](auto&... args) {                                            \
+                ((++index == tag && selected(index - 1) && (binary::deserialize(args, is), decoded = true)), ...); \
+            });                                                                   \
+            if (!decoded) binary::skipBytes(size, is);                            \
+        }                                                                         \
+    }                                                                             \
+    /* the listed fields as a tuple of references, used for columnar encoding */  \
+    auto serialization_fields() const {                                           \
+        return std::tie(__VA_ARGS__);                                             \
+    }                                                                             \
+    auto serialization_fields() {                                                 \
+        return std::tie(__VA_ARGS__);                                             \
+    }                                                                             \
     template <typename Func>                                                      \
     void apply(Func&& func) const {                                               \
         func(__VA_ARGS__);                                                        \
@@ -42,24 +207,30 @@
     void apply(Func&& func) {                                                     \
         func(__VA_ARGS__);                                                        \
     }                                                                             \
-    static void serialize_impl(std::ofstream& os) {}                              \
-    static void deserialize_impl(std::ifstream& is) {}                            \
-    template <typename T, typename... Args>                                       \
-    static void serialize_impl(std::ofstream& os, const T& first, const Args&... rest) { \
-        binary::serialize(first, os);                                             \
+    template <typename O>                                                         \
+    static void serialize_impl(O& os) {}                                          \
+    template <typename I>                                                         \
+    static void deserialize_impl(I& is) {}                                        \
+    template <typename O, typename T, typename... Args>                           \
+    static void serialize_impl(O& os, const T& first, const Args&... rest) {      \
+        binary::serializeField(first, os);                                        \
         serialize_impl(os, rest...);                                              \
     }                                                                             \
-    template <typename T, typename... Args>                                       \
-    static void deserialize_impl(std::ifstream& is, T& first, Args&... rest) {    \
-        binary::deserialize(first, is);                                           \
+    template <typename I, typename T, typename... Args>                           \
+    static void deserialize_impl(I& is, T& first, Args&... rest) {                \
+        binary::deserializeField(first, is);                                      \
         deserialize_impl(is, rest...);                                            \
     }                                                                             \
                                                                                   \
     friend void xmlSerialize(const Class& obj, const std::string& filename) {        \
         obj.xmlSerialize(filename);                                                  \
     }                                                                             \
-    friend void xmlDeserialize(Class& obj, std::string filename) {            \
-        obj.xmlDeserialize(filename);                                                \
+    friend void xmlDeserialize(Class& obj, std::string filename, bool overwrite = false) { \
+        obj.xmlDeserialize(filename, overwrite);                                  \
+    }                                                                             \
+    friend void xmlDeserializeFields(Class& obj, std::string filename,            \
+                                     std::initializer_list<std::string_view> fields, bool overwrite = false) { \
+        obj.xmlDeserializeFields(filename, fields, overwrite);                    \
     }                                                                             \
     void xmlSerialize(const std::string& filename) const {                           \
         tinyxml2::XMLDocument doc;                                                \
@@ -71,15 +242,34 @@
         apply([&](const auto&... args) { element->InsertEndChild(xml_serialize_impl(doc, element1, args...)); });        \
         doc.SaveFile(filename.c_str());                                           \
     }                                                                             \
-    void xmlDeserialize(std::string filename) {                            \
+    void xmlDeserialize(std::string filename, bool overwrite = false) {           \
         tinyxml2::XMLDocument doc;                                                \
         doc.LoadFile(filename.c_str());                                           \
         tinyxml2::XMLElement *element = doc.FirstChildElement()->FirstChildElement(); \
         tinyxml2::XMLElement *it = element->FirstChildElement(); \
-        apply([&](auto&... args) { xml_deserialize_impl(it, args...); });        \
+        apply([&](auto&... args) { xml_deserialize_impl(it, overwrite, args...); }); \
+    }                                                                             \
+    void xmlDeserializeFields(std::string filename, std::initializer_list<std::string_view> fields, \
+                              bool overwrite = false) {                           \
+        tinyxml2::XMLDocument doc;                                                \
+        doc.LoadFile(filename.c_str());                                           \
+        tinyxml2::XMLElement *it = doc.FirstChildElement()->FirstChildElement()->FirstChildElement(); \
+        size_t index = 0;                                                         \
+        apply([&](auto&... args) {                                                \
+            (xml_deserialize_field(it, overwrite, args, serialization_selected(fields, index++)), ...); \
+        });                                                                       \
+    }                                                                             \
+    tinyxml2::XMLElement *xmlSerializeTo(tinyxml2::XMLDocument& doc) const {      \
+        tinyxml2::XMLElement *element = doc.NewElement("user_defined");           \
+        apply([&](const auto&... args) { xml_serialize_impl(doc, element, args...); }); \
+        return element;                                                           \
+    }                                                                             \
+    void xmlDeserializeFrom(tinyxml2::XMLElement *element, bool overwrite) {      \
+        tinyxml2::XMLElement *it = element->FirstChildElement();                  \
+        apply([&](auto&... args) { xml_deserialize_impl(it, overwrite, args...); }); \
     }                                                                             \
     static tinyxml2::XMLElement *xml_serialize_impl(tinyxml2::XMLDocument& doc, tinyxml2::XMLElement *element) {return nullptr;}                              \
-    static void xml_deserialize_impl(tinyxml2::XMLElement *element) {}                            \
+    static void xml_deserialize_impl(tinyxml2::XMLElement *element, bool overwrite) {} \
     template <typename T, typename... Args>                                       \
     static tinyxml2::XMLElement *xml_serialize_impl(tinyxml2::XMLDocument& doc, tinyxml2::XMLElement *element, const T& first, const Args&... rest) { \
         tinyxml2::XMLElement *ele1 = xml::serialize(first, doc, false);                                             \
@@ -87,13 +277,20 @@
         xml_serialize_impl(doc, element, rest...); \
         return element;                                                    \
     }                                                                             \
+    /* unselected fields only cost a step to the next sibling */                 \
+    template <typename T>                                                         \
+    static void xml_deserialize_field(tinyxml2::XMLElement *&element, bool overwrite, T& value, bool selected) { \
+        if (element == nullptr) return;                                           \
+        if (selected) xml::deserialize(value, element, false, overwrite);         \
+        element = element->NextSiblingElement();                                  \
+    }                                                                             \
     template <typename T, typename... Args>                                       \
-    static void xml_deserialize_impl(tinyxml2::XMLElement *element, T& first, Args&... rest) {    \
+    static void xml_deserialize_impl(tinyxml2::XMLElement *element, bool overwrite, T& first, Args&... rest) { \
         if (element != nullptr) { \
-            xml::deserialize(first, element, false);                                           \
+            xml::deserialize(first, element, false, overwrite);                                \
         } \
         element = element->NextSiblingElement(); \
-        xml_deserialize_impl(element, rest...);                                            \
+        xml_deserialize_impl(element, overwrite, rest...);                                 \
     }                                                                             \
 
 
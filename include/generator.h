@@ -0,0 +1,78 @@
+#ifndef GENERATOR_H
+#define GENERATOR_H
+
+#include <coroutine>
+#include <exception>
+#include <iterator>
+#include <utility>
+
+namespace binary {
+    // coroutine yielding const T & to a range-for loop, one value per resumption. A
+    // yielded value lives only until the loop asks for the next one
+    template <class T>
+    class Generator {
+    public:
+        struct promise_type {
+            const T *current = nullptr;
+
+            Generator get_return_object() {
+                return Generator(std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+            std::suspend_always initial_suspend() noexcept { return {}; }
+            std::suspend_always final_suspend() noexcept { return {}; }
+            std::suspend_always yield_value(const T &value) noexcept {
+                current = &value;
+                return {};
+            }
+            void return_void() {}
+            void unhandled_exception() { std::terminate(); }
+        };
+
+        class iterator {
+        public:
+            using iterator_category = std::input_iterator_tag;
+            using value_type = T;
+            using difference_type = std::ptrdiff_t;
+
+            iterator() = default;
+            explicit iterator(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+            const T &operator*() const { return *handle_.promise().current; }
+            const T *operator->() const { return handle_.promise().current; }
+            iterator &operator++() {
+                handle_.resume();
+                return *this;
+            }
+            void operator++(int) { ++*this; }
+            bool operator==(std::default_sentinel_t) const { return !handle_ || handle_.done(); }
+
+        private:
+            std::coroutine_handle<promise_type> handle_;
+        };
+
+        Generator(Generator &&other) noexcept : handle_(std::exchange(other.handle_, {})) {}
+        Generator &operator=(Generator &&other) noexcept {
+            if (this != &other) {
+                if (handle_) handle_.destroy();
+                handle_ = std::exchange(other.handle_, {});
+            }
+            return *this;
+        }
+        ~Generator() {
+            if (handle_) handle_.destroy();
+        }
+
+        iterator begin() {
+            if (handle_) handle_.resume();
+            return iterator(handle_);
+        }
+        std::default_sentinel_t end() { return {}; }
+
+    private:
+        explicit Generator(std::coroutine_handle<promise_type> handle) : handle_(handle) {}
+
+        std::coroutine_handle<promise_type> handle_;
+    };
+}
+
+#endif // !GENERATOR_H
@@ -0,0 +1,370 @@
+#ifndef KEYED_LOG_H
+#define KEYED_LOG_H
+
+#include "binary_io.h"
+#include "record_log.h"
+#include "serialize_binary.h"
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <fcntl.h>
+#include <sys/resource.h>
+#include <sys/syscall.h>
+#include <unistd.h>
+
+// key-value store persisted as a directory of RecordLog segments, with the live set held
+// in memory. Every put or erase is appended to the active segment as
+//   kind (u8, 1 put / 0 erase), key, value (puts only)
+// and a background thread compacts the older segments once superseded records pile up.
+//
+// A directory holds
+//   NNNNNNNN.log   segments, replayed in id order
+//   NNNNNNNN.base  a compacted segment: the live set of every segment up to its id
+// Compaction seals the active segment and opens the next one, so appends continue while
+// the sealed segments are merged into NNNNNNNN.base.tmp; renaming that to .base is the
+// commit point, after which the segments it covers are removed. A crash anywhere in
+// between leaves either the old segments or the new base as the authoritative state.
+namespace binary {
+    struct CompactionOptions {
+        LogOptions log;                                  // fsync policy of the active segment
+        double garbageRatio = 2.0;                       // compact once records on disk reach this multiple of live keys
+        uint64_t minRecords = 1 << 16;                   // ... and at least this many
+        uint64_t bytesPerSecond = 32 << 20;              // compaction I/O budget, 0 for unthrottled
+        std::chrono::milliseconds checkInterval{1000};   // how often the compactor looks; 0 disables it
+    };
+
+    // paces a stream of I/O to a byte rate by sleeping once it runs ahead
+    class Throttle {
+    public:
+        explicit Throttle(uint64_t bytesPerSecond)
+            : rate_(bytesPerSecond), start_(std::chrono::steady_clock::now()) {}
+
+        void consume(size_t bytes) {
+            if (rate_ == 0) return;
+            bytes_ += bytes;
+            auto due = start_ + std::chrono::microseconds(bytes_ * 1000000 / rate_);
+            if (due > std::chrono::steady_clock::now()) std::this_thread::sleep_until(due);
+        }
+
+    private:
+        uint64_t rate_;
+        uint64_t bytes_ = 0;
+        std::chrono::steady_clock::time_point start_;
+    };
+
+    // reads and writes may come from any number of threads. Writes to one key take effect
+    // in the order they are appended, so live_ always agrees with a replay of the log
+    template <class K, class V, class F = Fixed>
+    class KeyedLog {
+    public:
+        explicit KeyedLog(std::string directory, CompactionOptions options = {})
+            : directory_(std::move(directory)), options_(options) {
+            std::error_code error;
+            std::filesystem::create_directories(directory_, error);
+            if (error || !recover()) {
+                std::cerr << "Error opening file when serilization." << std::endl;
+                fail_ = true;
+                return;
+            }
+            if (options_.checkInterval.count() > 0) compactor_ = std::thread([this] { compactLoop(); });
+        }
+
+        ~KeyedLog() {
+            {
+                std::lock_guard<std::mutex> lock(stopMutex_);
+                stop_ = true;
+            }
+            stopCompactor_.notify_all();
+            if (compactor_.joinable()) compactor_.join();
+        }
+
+        KeyedLog(const KeyedLog &) = delete;
+        KeyedLog &operator=(const KeyedLog &) = delete;
+
+        bool put(const K &key, const V &value) {
+            if (fail_) return false;
+            thread_local Buffer payload;
+            payload.clear();
+            Formatted<Buffer, F> out(payload);
+            serialize(uint8_t(1), out);
+            serialize(key, out);
+            serialize(value, out);
+            return append(payload.bytes(), [&] { live_.insert_or_assign(key, value); });
+        }
+
+        bool erase(const K &key) {
+            if (fail_) return false;
+            thread_local Buffer payload;
+            payload.clear();
+            Formatted<Buffer, F> out(payload);
+            serialize(uint8_t(0), out);
+            serialize(key, out);
+            return append(payload.bytes(), [&] { live_.erase(key); });
+        }
+
+        std::optional<V> get(const K &key) const {
+            std::lock_guard<std::mutex> lock(mutex_);
+            auto it = live_.find(key);
+            if (it == live_.end()) return std::nullopt;
+            return it->second;
+        }
+
+        size_t size() const {
+            std::lock_guard<std::mutex> lock(mutex_);
+            return live_.size();
+        }
+
+        // records across all segments on disk, superseded ones included
+        uint64_t diskRecords() const { return diskRecords_; }
+        uint64_t compactions() const { return compactions_; }
+
+        // compacts every segment but the active one, on the calling thread
+        bool compact() {
+            if (fail_) return false;
+            std::lock_guard<std::mutex> compacting(compactMutex_);
+            return compactSealed();
+        }
+
+        bool fail() const { return fail_; }
+        explicit operator bool() const { return !fail_; }
+
+    private:
+        struct Segment {
+            uint64_t id;
+            bool base;
+        };
+
+        std::string path(uint64_t id, const char *suffix) const {
+            char name[32];
+            std::snprintf(name, sizeof(name), "%08llu%s", static_cast<unsigned long long>(id), suffix);
+            return (std::filesystem::path(directory_) / name).string();
+        }
+
+        // queues payload on the active segment and applies it to live_ in the same order,
+        // then waits for the write outside order_ so concurrent writers share a batch
+        template <class Apply>
+        bool append(std::span<const std::byte> payload, Apply apply) {
+            std::shared_lock<std::shared_mutex> rotating(rotate_);
+            uint64_t ticket;
+            {
+                std::lock_guard<std::mutex> ordered(order_);
+                ticket = active_->enqueue(payload);
+                if (ticket == 0) return false;
+                std::lock_guard<std::mutex> lock(mutex_);
+                apply();
+            }
+            if (!active_->wait(ticket)) return false;
+            diskRecords_++;
+            return true;
+        }
+
+        // applies one record to map; false if it does not decode
+        bool apply(std::map<K, V> &map, std::span<const std::byte> payload) {
+            BufferReader reader(payload);
+            Formatted<BufferReader, F> in(reader);
+            uint8_t kind = 0;
+            K key{};
+            deserialize(kind, in);
+            deserialize(key, in);
+            if (kind == 0) {
+                if (reader.fail()) return false;
+                map.erase(key);
+                return true;
+            }
+            V value{};
+            deserialize(value, in);
+            if (reader.fail()) return false;
+            map.insert_or_assign(std::move(key), std::move(value));
+            return true;
+        }
+
+        // lists the directory, drops whatever a committed base covers, replays the rest
+        // into live_ and opens a fresh active segment after them
+        bool recover() {
+            std::vector<Segment> segments;
+            std::error_code error, ignored;
+            for (const auto &entry : std::filesystem::directory_iterator(directory_, error)) {
+                std::string name = entry.path().filename().string();
+                std::string suffix = entry.path().extension().string();
+                if (suffix == ".tmp") {
+                    std::filesystem::remove(entry.path(), ignored);
+                    continue;
+                }
+                if (suffix != ".log" && suffix != ".base") continue;
+                char *end = nullptr;
+                uint64_t id = std::strtoull(name.c_str(), &end, 10);
+                if (end != name.c_str() + name.size() - suffix.size()) continue;
+                segments.push_back({id, suffix == ".base"});
+            }
+            if (error) return false;
+            std::sort(segments.begin(), segments.end(), [](const Segment &a, const Segment &b) {
+                return a.id != b.id ? a.id < b.id : a.base > b.base;
+            });
+
+            uint64_t covered = 0;
+            bool hasBase = false;
+            for (const Segment &segment : segments) {
+                if (segment.base) {
+                    covered = segment.id;
+                    hasBase = true;
+                }
+            }
+            uint64_t next = 1;
+            for (const Segment &segment : segments) {
+                next = std::max(next, segment.id + 1);
+                bool superseded = hasBase && (segment.id < covered || (segment.id == covered && !segment.base));
+                if (superseded) {
+                    std::filesystem::remove(path(segment.id, segment.base ? ".base" : ".log"), ignored);
+                    continue;
+                }
+                const char *suffix = segment.base ? ".base" : ".log";
+                for (std::span<const std::byte> payload : logPayloads(path(segment.id, suffix))) {
+                    if (!apply(live_, payload)) break;
+                    diskRecords_++;
+                }
+                sealed_.push_back(segment);
+            }
+            activeId_ = next;
+            active_ = std::make_unique<RecordLog>(path(activeId_, ".log"), options_.log);
+            return static_cast<bool>(*active_);
+        }
+
+        void compactLoop() {
+            // lowest CPU priority, so on a busy machine merging only uses idle time
+            ::setpriority(PRIO_PROCESS, static_cast<id_t>(::syscall(SYS_gettid)), 19);
+            std::unique_lock<std::mutex> lock(stopMutex_);
+            while (!stop_) {
+                stopCompactor_.wait_for(lock, options_.checkInterval, [this] { return stop_.load(); });
+                if (stop_) break;
+                lock.unlock();
+                uint64_t records = diskRecords_;
+                if (records >= options_.minRecords && records >= options_.garbageRatio * size()) compact();
+                lock.lock();
+            }
+        }
+
+        // seals the active segment, merges every sealed one into a new base and swaps it in
+        bool compactSealed() {
+            std::vector<Segment> sealed;
+            uint64_t sealedRecords = 0;
+            std::unique_ptr<RecordLog> previous;
+            {
+                std::unique_lock<std::shared_mutex> rotating(rotate_);
+                sealedRecords = diskRecords_;
+                sealed_.push_back({activeId_, false});
+                sealed = sealed_;
+                activeId_++;
+                auto active = std::make_unique<RecordLog>(path(activeId_, ".log"), options_.log);
+                if (!*active) {
+                    std::cerr << "Error opening file when serilization." << std::endl;
+                    sealed_.pop_back();
+                    activeId_--;
+                    return false;
+                }
+                previous = std::exchange(active_, std::move(active));
+            }
+            // closed outside the lock; its records were written before their appends
+            // returned, so they can be read back without syncing
+            previous.reset();
+
+            Throttle throttle(options_.bytesPerSecond);
+            std::map<K, V> merged;
+            for (const Segment &segment : sealed) {
+                for (std::span<const std::byte> payload : logPayloads(path(segment.id, segment.base ? ".base" : ".log"))) {
+                    if (!apply(merged, payload)) break;
+                    throttle.consume(payload.size() + 8);
+                }
+                if (stop_) return false;
+            }
+
+            uint64_t id = sealed.back().id;
+            std::string temporary = path(id, ".base.tmp");
+            std::remove(temporary.c_str());
+            {
+                RecordLog base(temporary);
+                if (!base) return false;
+                Buffer payload;
+                for (const auto &[key, value] : merged) {
+                    payload.clear();
+                    Formatted<Buffer, F> out(payload);
+                    serialize(uint8_t(1), out);
+                    serialize(key, out);
+                    serialize(value, out);
+                    if (stop_ || !base.appendBytes(payload.bytes())) {
+                        std::remove(temporary.c_str());
+                        return false;
+                    }
+                    throttle.consume(payload.size() + 8);
+                }
+                if (!base.sync()) return false;
+            }
+            std::error_code error;
+            std::filesystem::rename(temporary, path(id, ".base"), error);
+            if (error) {
+                std::cerr << "Error opening file when serilization." << std::endl;
+                return false;
+            }
+            syncDirectory();
+
+            {
+                std::unique_lock<std::shared_mutex> rotating(rotate_);
+                sealed_.erase(sealed_.begin(), sealed_.begin() + sealed.size());
+                sealed_.insert(sealed_.begin(), {id, true});
+                diskRecords_ -= sealedRecords - merged.size();
+            }
+            for (const Segment &segment : sealed) {
+                if (!segment.base || segment.id != id) std::filesystem::remove(path(segment.id, segment.base ? ".base" : ".log"), error);
+            }
+            compactions_++;
+            return true;
+        }
+
+        // makes the rename durable
+        void syncDirectory() {
+            int fd = ::open(directory_.c_str(), O_RDONLY | O_DIRECTORY);
+            if (fd < 0) return;
+            ::fsync(fd);
+            ::close(fd);
+        }
+
+        std::string directory_;
+        CompactionOptions options_;
+        bool fail_ = false;
+
+        mutable std::mutex mutex_;
+        std::map<K, V> live_;
+        std::mutex order_;                  // held from a write's enqueue to its update of live_,
+                                            // so live_ agrees with a replay of the segments
+
+        std::shared_mutex rotate_;          // appends share it, sealing the active segment takes it
+        std::unique_ptr<RecordLog> active_;
+        uint64_t activeId_ = 0;
+        std::vector<Segment> sealed_;       // on disk before the active segment, oldest first
+        std::atomic<uint64_t> diskRecords_ = 0;
+        std::atomic<uint64_t> compactions_ = 0;
+
+        std::mutex compactMutex_;
+        std::thread compactor_;
+        std::mutex stopMutex_;
+        std::condition_variable stopCompactor_;
+        std::atomic<bool> stop_ = false;    // also abandons a compaction in progress
+    };
+}
+
+#endif // !KEYED_LOG_H
@@ -0,0 +1,208 @@
+#ifndef LAZY_H
+#define LAZY_H
+
+#include "binary_io.h"
+#include "serialize_binary.h"
+#include <algorithm>
+#include <cstddef>
+#include <functional>
+#include <optional>
+#include <span>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+
+// containers over borrowed encoded bytes, e.g. a MappedFile or a Buffer, that decode an
+// element only when it is asked for. They read the std::vector / std::map layout written
+// by the usual overloads in format F, and the bytes must outlive them. Neither is safe to
+// use from several threads at once, since lookups fill in offsets and memoized values
+namespace binary {
+    // bytes every encoded T takes in format F, or 0 if it varies
+    template <class T, class F>
+    constexpr size_t encodedWidth() {
+        if constexpr (is_pair<T>::value) {
+            constexpr size_t first = encodedWidth<typename T::first_type, F>();
+            constexpr size_t second = encodedWidth<typename T::second_type, F>();
+            return first && second ? first + second : 0;
+        } else if constexpr (Arithmetic<T>) {
+            return F::varint && VarintEncoded<T> ? 0 : sizeof(T);
+        } else if constexpr (BulkCopyable<T>) {
+            return F::varint || F::framed ? 0 : sizeof(T);
+        } else {
+            return 0;
+        }
+    }
+
+    template <class T, class F = Fixed>
+    class lazy_vector {
+    public:
+        static_assert(!(F::columnar && FieldAccessible<T>), "columnar vectors are not stored element by element");
+
+        lazy_vector() = default;
+
+        // O(1): reads the length and borrows the rest of bytes
+        static lazy_vector open(std::span<const std::byte> bytes) {
+            lazy_vector value;
+            BufferReader reader(bytes);
+            Formatted<BufferReader, F> in(reader);
+            value.size_ = readSize(in);
+            value.header_ = reader.tell();
+            value.bytes_ = bytes.subspan(reader.tell());
+            value.fail_ = reader.fail();
+            return value;
+        }
+
+        size_t size() const { return size_; }
+        bool empty() const { return size_ == 0; }
+        bool fail() const { return fail_; }
+
+        // decodes element i on every call
+        T get(size_t i) const {
+            T value{};
+            BufferReader reader(bytes_.subspan(offset(i)));
+            Formatted<BufferReader, F> in(reader);
+            if constexpr (bulk) in.read(reinterpret_cast<char *>(&value), sizeof(T));
+            else deserialize(value, in);
+            return value;
+        }
+
+        // decodes element i on first access and keeps it for later ones
+        const T &operator[](size_t i) const {
+            auto it = cache_.find(i);
+            if (it == cache_.end()) it = cache_.emplace(i, get(i)).first;
+            return it->second;
+        }
+
+        // how far the encoding, length included, reaches into the borrowed bytes; steps
+        // over every element unless they all have the same width
+        size_t encodedSize() const { return header_ + offset(size_); }
+
+    private:
+        template <class K, class V, class C, class G> friend class lazy_map;
+
+        // mirrors the std::vector overloads, which store bulk-copyable elements as a block
+        static constexpr bool bulk = blockCopied<T, F>;
+        static constexpr size_t width = bulk ? sizeof(T) : encodedWidth<T, F>();
+
+        // start of element i, or of the end for i == size(); variable-width elements are
+        // stepped over once, up to the furthest one asked for
+        size_t offset(size_t i) const {
+            if constexpr (width != 0) {
+                return std::min(i * width, bytes_.size());
+            } else {
+                if (offsets_.empty()) offsets_.push_back(0);
+                if (i >= offsets_.size()) {
+                    BufferReader reader(bytes_.subspan(offsets_.back()));
+                    Formatted<BufferReader, F> in(reader);
+                    size_t start = offsets_.back();
+                    offsets_.reserve(i + 1);
+                    while (offsets_.size() <= i) {
+                        skip<T>(in);
+                        offsets_.push_back(start + reader.tell());
+                    }
+                    if (reader.fail()) fail_ = true;
+                }
+                return offsets_[i];
+            }
+        }
+
+        std::span<const std::byte> bytes_;
+        size_t header_ = 0;
+        size_t size_ = 0;
+        mutable std::vector<size_t> offsets_;
+        mutable std::unordered_map<size_t, T> cache_;
+        mutable bool fail_ = false;
+    };
+
+    // lookups binary search the encoded keys, decoding only those they compare against
+    template <class K, class V, class C = std::less<K>, class F = Fixed>
+    class lazy_map {
+    public:
+        static_assert(!(F::packed && PackedKey<K>), "packed map keys are not stored next to their values");
+
+        lazy_map() = default;
+
+        // O(1): reads the length and borrows the rest of bytes
+        static lazy_map open(std::span<const std::byte> bytes) {
+            lazy_map value;
+            value.entries_ = lazy_vector<std::pair<K, V>, F>::open(bytes);
+            return value;
+        }
+
+        size_t size() const { return entries_.size(); }
+        bool empty() const { return entries_.empty(); }
+        bool fail() const { return entries_.fail(); }
+        size_t encodedSize() const { return entries_.encodedSize(); }
+
+        K key(size_t i) const {
+            K key{};
+            BufferReader reader(entries_.bytes_.subspan(entries_.offset(i)));
+            Formatted<BufferReader, F> in(reader);
+            deserialize(key, in);
+            return key;
+        }
+
+        bool contains(const K &key) const { return locate(key) < size(); }
+
+        // decodes the value on every call
+        std::optional<V> get(const K &key) const {
+            size_t i = locate(key);
+            if (i == size()) return std::nullopt;
+            return value(i);
+        }
+
+        // decodes the value on first access and keeps it; nullptr if key is absent
+        const V *find(const K &key) const {
+            size_t i = locate(key);
+            if (i == size()) return nullptr;
+            auto it = cache_.find(i);
+            if (it == cache_.end()) it = cache_.emplace(i, value(i)).first;
+            return &it->second;
+        }
+
+    private:
+        V value(size_t i) const {
+            V value{};
+            BufferReader reader(entries_.bytes_.subspan(entries_.offset(i)));
+            Formatted<BufferReader, F> in(reader);
+            skip<K>(in);
+            deserialize(value, in);
+            return value;
+        }
+
+        // index of key, or size() if it is absent
+        size_t locate(const K &key) const {
+            size_t first = 0, last = size();
+            while (first < last) {
+                size_t mid = first + (last - first) / 2;
+                if (C()(this->key(mid), key)) first = mid + 1;
+                else last = mid;
+            }
+            return first < size() && !C()(key, this->key(first)) ? first : size();
+        }
+
+        lazy_vector<std::pair<K, V>, F> entries_;
+        mutable std::unordered_map<size_t, V> cache_;
+    };
+
+    // as a field of a larger value, e.g. a GENERATE_SERIALIZATION class decoded from a
+    // BufferReader over a MappedFile: the container borrows the source's bytes and the
+    // source moves past it, which steps over each element once unless they share a width
+    template <class T, class F, ViewSource I> requires requires(I &ifs) { ifs.remaining(); }
+    void deserialize(lazy_vector<T, F> &value, I &ifs) {
+        size_t remaining = ifs.remaining();
+        const std::byte *start = ifs.view(0);
+        value = lazy_vector<T, F>::open({start, start == nullptr ? 0 : remaining});
+        ifs.view(value.encodedSize());
+    }
+
+    template <class K, class V, class C, class F, ViewSource I> requires requires(I &ifs) { ifs.remaining(); }
+    void deserialize(lazy_map<K, V, C, F> &value, I &ifs) {
+        size_t remaining = ifs.remaining();
+        const std::byte *start = ifs.view(0);
+        value = lazy_map<K, V, C, F>::open({start, start == nullptr ? 0 : remaining});
+        ifs.view(value.encodedSize());
+    }
+}
+
+#endif // !LAZY_H
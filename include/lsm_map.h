@@ -0,0 +1,604 @@
+#ifndef LSM_MAP_H
+#define LSM_MAP_H
+
+#include "binary_io.h"
+#include "record_log.h"
+#include "serialize_binary.h"
+#include <algorithm>
+#include <condition_variable>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <deque>
+#include <filesystem>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <shared_mutex>
+#include <span>
+#include <string>
+#include <system_error>
+#include <thread>
+#include <vector>
+#include <fcntl.h>
+#include <unistd.h>
+
+// log-structured map: writes go to an in-memory memtable backed by a RecordLog write-ahead
+// log, full memtables are written out as sorted immutable runs, and a background thread
+// merges runs of the same level into one run of the next level.
+//
+// A run file holds its entries in key order, each as
+//   key, kind (u8, 1 live / 0 deleted), value (live only)
+// followed by
+//   first key of every block, as a std::vector<K>
+//   offset of every block, u64 each
+//   entry count, start of the first keys, start of the offsets, first id, level and
+//   RUN_MAGIC, u64 each
+// so a lookup is a binary search of the block keys held in memory and the decode of one
+// block of the mapped file.
+//
+// A directory holds
+//   NNNNNNNN.wal   write-ahead log of the memtable that becomes run NNNNNNNN
+//   NNNNNNNN.run   a run holding every write of the logs first id..NNNNNNNN
+// A flushed or merged run is written as a .tmp file and renamed into place, replacing the
+// newest run it covers; whatever a run covers is removed afterwards, and again on open if
+// a crash came in between.
+namespace binary {
+    constexpr uint64_t RUN_MAGIC = 0x314E555253494942;  // "BISRUN1"
+    constexpr size_t RUN_TRAILER = 6 * sizeof(uint64_t);
+
+    struct LsmOptions {
+        LogOptions log;                  // fsync policy of the write-ahead log
+        size_t memtableBytes = 64 << 20; // encoded bytes a memtable takes before it is flushed
+        size_t blockBytes = 4 << 10;     // bytes per indexed block of a run
+        size_t fanIn = 4;                // runs of one level merged together
+    };
+
+    template <class K, class V, class F = Fixed>
+    class LsmMap {
+    public:
+        explicit LsmMap(std::string directory, LsmOptions options = {})
+            : directory_(std::move(directory)), options_(options) {
+            if (options_.fanIn < 2) options_.fanIn = 2;
+            std::error_code error;
+            std::filesystem::create_directories(directory_, error);
+            if (error || !recover()) {
+                std::cerr << "Error opening file when serilization." << std::endl;
+                fail_ = true;
+                return;
+            }
+            worker_ = std::thread([this] { work(); });
+        }
+
+        // memtables not flushed yet stay in their write-ahead logs and are replayed on open
+        ~LsmMap() {
+            {
+                std::lock_guard<std::mutex> lock(state_);
+                stop_ = true;
+            }
+            changed_.notify_all();
+            if (worker_.joinable()) worker_.join();
+        }
+
+        LsmMap(const LsmMap &) = delete;
+        LsmMap &operator=(const LsmMap &) = delete;
+
+        bool put(const K &key, const V &value) { return write(key, &value); }
+        bool erase(const K &key) { return write(key, nullptr); }
+
+        std::optional<V> get(const K &key) const {
+            if (fail_) return std::nullopt;
+            std::shared_lock<std::shared_mutex> rotating(rotate_);
+            {
+                std::lock_guard<std::mutex> lock(memtable_->mutex);
+                auto it = memtable_->entries.find(key);
+                if (it != memtable_->entries.end()) return it->second;
+            }
+            std::vector<std::shared_ptr<const Memtable>> immutables;
+            std::vector<std::shared_ptr<const Run>> runs;
+            {
+                std::lock_guard<std::mutex> lock(state_);
+                immutables.assign(immutables_.begin(), immutables_.end());
+                runs = runs_;
+            }
+            rotating.unlock();
+            for (const auto &memtable : immutables) {
+                auto it = memtable->entries.find(key);
+                if (it != memtable->entries.end()) return it->second;
+            }
+            std::optional<V> value;
+            for (const auto &run : runs) {
+                if (run->find(key, value)) return value;
+            }
+            return std::nullopt;
+        }
+
+        // writes the memtable out as a run and waits for every pending flush
+        bool flush() {
+            if (fail_) return false;
+            rotate(0);
+            std::unique_lock<std::mutex> lock(state_);
+            changed_.wait(lock, [this] { return immutables_.empty() || failed_; });
+            return !failed_;
+        }
+
+        // flushes, then merges every run into one, dropping deleted entries
+        bool compact() {
+            if (!flush()) return false;
+            std::lock_guard<std::mutex> merging(merge_);
+            std::vector<std::shared_ptr<const Run>> runs;
+            {
+                std::lock_guard<std::mutex> lock(state_);
+                runs = runs_;
+            }
+            return runs.size() < 2 || merge(runs);
+        }
+
+        size_t runs() const {
+            std::lock_guard<std::mutex> lock(state_);
+            return runs_.size();
+        }
+
+        bool fail() const { return fail_ || failed_; }
+        explicit operator bool() const { return !fail(); }
+
+    private:
+        struct Memtable {
+            mutable std::mutex mutex;             // only taken while the memtable is active
+            std::mutex order;                     // held from a write's log enqueue to its insert
+            std::map<K, std::optional<V>> entries;
+            uint64_t firstId = 0;                 // logs replayed into it on open
+            uint64_t lastId = 0;                  // its own log
+            size_t bytes = 0;
+            std::unique_ptr<RecordLog> log;
+        };
+
+        class Run {
+        public:
+            Run(const std::string &filename, uint64_t id)
+                : id_(id), file_(std::make_unique<MappedFile>(filename, MmapOptions{false, false})) {
+                std::span<const std::byte> bytes = file_->bytes();
+                uint64_t trailer[6];
+                if (file_->fail() || bytes.size() < RUN_TRAILER) return;
+                std::memcpy(trailer, bytes.data() + bytes.size() - RUN_TRAILER, RUN_TRAILER);
+                if (trailer[5] != RUN_MAGIC || trailer[1] > trailer[2] || trailer[2] > bytes.size() - RUN_TRAILER) return;
+                BufferReader reader(bytes.subspan(trailer[1], trailer[2] - trailer[1]));
+                Formatted<BufferReader, F> in(reader);
+                deserialize(keys_, in);
+                size_t blocks = (bytes.size() - RUN_TRAILER - trailer[2]) / sizeof(uint64_t);
+                if (reader.fail() || keys_.size() != blocks) return;
+                offsets_.resize(blocks);
+                std::memcpy(offsets_.data(), bytes.data() + trailer[2], blocks * sizeof(uint64_t));
+                // find() slices entries_ between neighbouring offsets
+                for (size_t b = 0; b < blocks; b++) {
+                    if (offsets_[b] > trailer[1] || (b > 0 && offsets_[b] < offsets_[b - 1])) return;
+                }
+                entries_ = bytes.first(trailer[1]);
+                count_ = trailer[0];
+                firstId_ = trailer[3];
+                level_ = trailer[4];
+                ok_ = true;
+            }
+
+            bool ok() const { return ok_; }
+            uint64_t id() const { return id_; }          // the id its file is named after
+            uint64_t firstId() const { return firstId_; }
+            uint64_t level() const { return level_; }
+            uint64_t count() const { return count_; }
+            std::span<const std::byte> entries() const { return entries_; }
+
+            // true if the run has an entry for key: value is set for a live one and reset
+            // for a deleted one
+            bool find(const K &key, std::optional<V> &value) const {
+                auto block = std::upper_bound(keys_.begin(), keys_.end(), key);
+                if (block == keys_.begin()) return false;
+                size_t index = block - keys_.begin() - 1;
+                size_t end = index + 1 < offsets_.size() ? offsets_[index + 1] : entries_.size();
+                BufferReader reader(entries_.subspan(offsets_[index], end - offsets_[index]));
+                Formatted<BufferReader, F> in(reader);
+                K current{};
+                while (reader.remaining() > 0) {
+                    uint8_t kind = 0;
+                    deserialize(current, in);
+                    deserialize(kind, in);
+                    if (reader.fail() || key < current) return false;
+                    if (current < key) {
+                        if (kind != 0) skip<V>(in);
+                        continue;
+                    }
+                    if (kind == 0) {
+                        value.reset();
+                    } else {
+                        deserialize(value.emplace(), in);
+                    }
+                    return !reader.fail();
+                }
+                return false;
+            }
+
+        private:
+            uint64_t id_;
+            std::unique_ptr<MappedFile> file_;
+            std::vector<K> keys_;                 // first key of every block
+            std::vector<uint64_t> offsets_;
+            std::span<const std::byte> entries_;
+            uint64_t count_ = 0;
+            uint64_t firstId_ = 0;
+            uint64_t level_ = 0;
+            bool ok_ = false;
+        };
+
+        // reads a run's entries in key order
+        class Cursor {
+        public:
+            explicit Cursor(std::span<const std::byte> entries) : reader_(entries) { next(); }
+
+            bool valid() const { return valid_; }
+            const K &key() const { return key_; }
+            const std::optional<V> &value() const { return value_; }
+
+            void next() {
+                valid_ = reader_.remaining() > 0;
+                if (!valid_) return;
+                Formatted<BufferReader, Overwrite<F>> in(reader_);
+                uint8_t kind = 0;
+                deserialize(key_, in);
+                deserialize(kind, in);
+                if (kind == 0) {
+                    value_.reset();
+                } else {
+                    if (!value_) value_.emplace();
+                    deserialize(*value_, in);
+                }
+                valid_ = !reader_.fail();
+            }
+
+        private:
+            BufferReader reader_;
+            K key_{};
+            std::optional<V> value_;
+            bool valid_ = false;
+        };
+
+        // writes sorted entries as a run; add() them in key order, then finish()
+        class RunWriter {
+        public:
+            RunWriter(const std::string &filename, size_t blockBytes)
+                : sink_(filename), counted_(sink_), out_(counted_), blockBytes_(blockBytes) {}
+
+            explicit operator bool() const { return static_cast<bool>(sink_); }
+
+            void add(const K &key, const std::optional<V> &value) {
+                if (keys_.empty() || counted_.size() - offsets_.back() >= blockBytes_) {
+                    keys_.push_back(key);
+                    offsets_.push_back(counted_.size());
+                }
+                serialize(key, out_);
+                serialize(uint8_t(value ? 1 : 0), out_);
+                if (value) serialize(*value, out_);
+                count_++;
+            }
+
+            bool finish(uint64_t firstId, uint64_t level) {
+                uint64_t keysStart = counted_.size();
+                serialize(keys_, out_);
+                uint64_t trailer[] = {count_, keysStart, counted_.size(), firstId, level, RUN_MAGIC};
+                sink_.write(reinterpret_cast<const char *>(offsets_.data()), offsets_.size() * sizeof(uint64_t));
+                sink_.write(reinterpret_cast<const char *>(trailer), sizeof(trailer));
+                return sink_.sync() && sink_.close();
+            }
+
+        private:
+            FdSink sink_;
+            Counted<FdSink> counted_;
+            Formatted<Counted<FdSink>, F> out_;
+            size_t blockBytes_;
+            std::vector<K> keys_;
+            std::vector<uint64_t> offsets_;
+            uint64_t count_ = 0;
+        };
+
+        std::string path(uint64_t id, const char *suffix) const {
+            char name[32];
+            std::snprintf(name, sizeof(name), "%08llu%s", static_cast<unsigned long long>(id), suffix);
+            return (std::filesystem::path(directory_) / name).string();
+        }
+
+        bool write(const K &key, const V *value) {
+            if (fail_) return false;
+            thread_local Buffer payload;
+            payload.clear();
+            Formatted<Buffer, F> out(payload);
+            serialize(uint8_t(value != nullptr ? 1 : 0), out);
+            serialize(key, out);
+            if (value != nullptr) serialize(*value, out);
+
+            // at most two memtables wait for their flush
+            {
+                std::unique_lock<std::mutex> lock(state_);
+                changed_.wait(lock, [this] { return immutables_.size() < 2 || failed_; });
+                if (failed_) return false;
+            }
+            size_t bytes = 0;
+            uint64_t id = 0;
+            {
+                std::shared_lock<std::shared_mutex> rotating(rotate_);
+                Memtable &memtable = *memtable_;
+                // writes reach the memtable in log order, so a replay of the log agrees
+                // with it when two of them race on one key. The write itself is waited
+                // for outside the lock, so concurrent writes share the log's batches
+                uint64_t ticket;
+                {
+                    std::lock_guard<std::mutex> ordered(memtable.order);
+                    ticket = memtable.log->enqueue(payload.bytes());
+                    if (ticket == 0) return false;
+                    std::lock_guard<std::mutex> lock(memtable.mutex);
+                    if (value != nullptr) {
+                        memtable.entries.insert_or_assign(key, *value);
+                    } else {
+                        memtable.entries.insert_or_assign(key, std::nullopt);
+                    }
+                    memtable.bytes += payload.size();
+                    bytes = memtable.bytes;
+                    id = memtable.lastId;
+                }
+                if (!memtable.log->wait(ticket)) return false;
+            }
+            if (bytes >= options_.memtableBytes) rotate(id);
+            return true;
+        }
+
+        // hands the memtable with log id (any non-empty one for 0) to the flusher and
+        // starts a new one
+        void rotate(uint64_t id) {
+            std::unique_lock<std::shared_mutex> rotating(rotate_);
+            if ((id != 0 && memtable_->lastId != id) || memtable_->entries.empty()) return;
+            auto next = std::make_shared<Memtable>();
+            next->firstId = next->lastId = memtable_->lastId + 1;
+            next->log = std::make_unique<RecordLog>(path(next->lastId, ".wal"), options_.log);
+            if (!*next->log) {
+                std::cerr << "Error opening file when serilization." << std::endl;
+                return;
+            }
+            memtable_->log.reset();
+            {
+                std::lock_guard<std::mutex> lock(state_);
+                immutables_.push_front(std::move(memtable_));
+            }
+            memtable_ = std::move(next);
+            changed_.notify_all();
+        }
+
+        bool recover() {
+            struct File {
+                uint64_t id;
+                bool run;
+            };
+            std::vector<File> files;
+            std::error_code error, ignored;
+            for (const auto &entry : std::filesystem::directory_iterator(directory_, error)) {
+                std::string name = entry.path().filename().string();
+                std::string suffix = entry.path().extension().string();
+                if (suffix == ".tmp") {
+                    std::filesystem::remove(entry.path(), ignored);
+                    continue;
+                }
+                if (suffix != ".wal" && suffix != ".run") continue;
+                char *end = nullptr;
+                uint64_t id = std::strtoull(name.c_str(), &end, 10);
+                if (end != name.c_str() + name.size() - suffix.size()) continue;
+                files.push_back({id, suffix == ".run"});
+            }
+            if (error) return false;
+            // newest first, so every run is seen before the ones it covers
+            std::sort(files.begin(), files.end(), [](const File &a, const File &b) {
+                return a.id != b.id ? a.id > b.id : a.run > b.run;
+            });
+
+            uint64_t covered = UINT64_MAX;  // ids below this are in the runs kept so far
+            uint64_t next = 1;
+            std::vector<uint64_t> logs;
+            for (const File &file : files) {
+                next = std::max(next, file.id + 1);
+                if (file.id >= covered) {
+                    std::filesystem::remove(path(file.id, file.run ? ".run" : ".wal"), ignored);
+                } else if (file.run) {
+                    auto run = std::make_shared<Run>(path(file.id, ".run"), file.id);
+                    if (!run->ok()) {
+                        std::cerr << "Error reading index when deserilization." << std::endl;
+                        return false;
+                    }
+                    covered = run->firstId();
+                    runs_.push_back(std::move(run));
+                } else if (runs_.empty()) {
+                    logs.push_back(file.id);
+                } else {
+                    // a log older than a run that does not cover it: the directory was
+                    // not written by us
+                    return false;
+                }
+            }
+
+            // the newest log stays the active one
+            memtable_ = std::make_shared<Memtable>();
+            memtable_->firstId = logs.empty() ? next : logs.back();
+            memtable_->lastId = logs.empty() ? next : logs.front();
+            for (auto it = logs.rbegin(); it != logs.rend(); ++it) {
+                for (std::span<const std::byte> payload : logPayloads(path(*it, ".wal"))) {
+                    BufferReader reader(payload);
+                    Formatted<BufferReader, F> in(reader);
+                    uint8_t kind = 0;
+                    K key{};
+                    deserialize(kind, in);
+                    deserialize(key, in);
+                    std::optional<V> value;
+                    if (kind != 0) deserialize(value.emplace(), in);
+                    if (reader.fail()) break;
+                    memtable_->entries.insert_or_assign(std::move(key), std::move(value));
+                    memtable_->bytes += payload.size();
+                }
+            }
+            memtable_->log = std::make_unique<RecordLog>(path(memtable_->lastId, ".wal"), options_.log);
+            return static_cast<bool>(*memtable_->log);
+        }
+
+        void work() {
+            std::unique_lock<std::mutex> lock(state_);
+            while (true) {
+                changed_.wait(lock, [this] { return stop_ || failed_ || !immutables_.empty() || mergeable(); });
+                if (stop_ || failed_) return;
+                if (!immutables_.empty()) {
+                    std::shared_ptr<const Memtable> memtable = immutables_.back();
+                    lock.unlock();
+                    bool flushed = flushRun(*memtable);
+                    lock.lock();
+                    failed_ = !flushed;
+                    changed_.notify_all();
+                    continue;
+                }
+                // merges wait for flushes: the newest level is reconsidered after each one
+                lock.unlock();
+                bool merged;
+                {
+                    std::lock_guard<std::mutex> merging(merge_);
+                    std::vector<std::shared_ptr<const Run>> group;
+                    {
+                        std::lock_guard<std::mutex> state(state_);
+                        group = mergeGroup();
+                    }
+                    merged = merge(group);
+                }
+                lock.lock();
+                if (!merged) {
+                    std::cerr << "Error writing file when serilization." << std::endl;
+                    failed_ = true;
+                    changed_.notify_all();
+                }
+            }
+        }
+
+        bool flushRun(const Memtable &memtable) {
+            std::string temporary = path(memtable.lastId, ".run.tmp");
+            {
+                RunWriter writer(temporary, options_.blockBytes);
+                if (!writer) return false;
+                for (const auto &[key, value] : memtable.entries) writer.add(key, value);
+                if (!writer.finish(memtable.firstId, 0)) return false;
+            }
+            return install(temporary, memtable.lastId, {}, &memtable);
+        }
+
+        // runs of the lowest level that has fanIn of them, newest first; they are
+        // always adjacent, since levels only grow from the newest run to the oldest
+        std::vector<std::shared_ptr<const Run>> mergeGroup() const {
+            std::vector<std::shared_ptr<const Run>> group;
+            for (const auto &run : runs_) {
+                if (!group.empty() && run->level() != group.front()->level()) {
+                    if (group.size() >= options_.fanIn) break;
+                    group.clear();
+                }
+                group.push_back(run);
+            }
+            if (group.size() < options_.fanIn) group.clear();
+            return group;
+        }
+
+        bool mergeable() const { return !mergeGroup().empty(); }
+
+        // merges runs, newest first, into one run of the next level; entries of newer
+        // runs win, and deleted ones are dropped once nothing older is left
+        bool merge(const std::vector<std::shared_ptr<const Run>> &runs) {
+            if (runs.empty()) return true;
+            bool oldest;
+            {
+                std::lock_guard<std::mutex> lock(state_);
+                oldest = !runs_.empty() && runs_.back() == runs.back();
+            }
+            uint64_t id = runs.front()->id();
+            uint64_t level = 0;
+            for (const auto &run : runs) level = std::max(level, run->level());
+            std::string temporary = path(id, ".run.tmp");
+            {
+                RunWriter writer(temporary, options_.blockBytes);
+                if (!writer) return false;
+                std::vector<Cursor> cursors;
+                cursors.reserve(runs.size());
+                for (const auto &run : runs) cursors.emplace_back(run->entries());
+                while (true) {
+                    // the smallest key, taken from the newest run that has it
+                    Cursor *smallest = nullptr;
+                    for (Cursor &cursor : cursors) {
+                        if (cursor.valid() && (smallest == nullptr || cursor.key() < smallest->key())) smallest = &cursor;
+                    }
+                    if (smallest == nullptr) break;
+                    if (smallest->value() || !oldest) writer.add(smallest->key(), smallest->value());
+                    K key = smallest->key();
+                    for (Cursor &cursor : cursors) {
+                        if (cursor.valid() && !(key < cursor.key())) cursor.next();
+                    }
+                }
+                if (!writer.finish(runs.back()->firstId(), level + 1)) return false;
+            }
+            return install(temporary, id, runs, nullptr);
+        }
+
+        // renames a written run into place and swaps it in for the runs or memtable it
+        // replaces, then removes their files
+        bool install(const std::string &temporary, uint64_t id, const std::vector<std::shared_ptr<const Run>> &replaced,
+                     const Memtable *memtable) {
+            std::error_code error;
+            std::filesystem::rename(temporary, path(id, ".run"), error);
+            if (error) return false;
+            syncDirectory();
+            auto run = std::make_shared<const Run>(path(id, ".run"), id);
+            if (!run->ok()) return false;
+
+            std::vector<uint64_t> removed;
+            {
+                std::lock_guard<std::mutex> lock(state_);
+                if (memtable != nullptr) {
+                    runs_.insert(runs_.begin(), run);
+                    immutables_.pop_back();
+                    for (uint64_t log = memtable->firstId; log <= memtable->lastId; log++) removed.push_back(log);
+                } else {
+                    // replaced runs are adjacent: flushes only add runs in front of them
+                    for (size_t i = 1; i < replaced.size(); i++) removed.push_back(replaced[i]->id());
+                    auto first = std::find(runs_.begin(), runs_.end(), replaced.front());
+                    first = runs_.erase(first, first + replaced.size());
+                    runs_.insert(first, run);
+                }
+            }
+            for (uint64_t old : removed) std::filesystem::remove(path(old, memtable != nullptr ? ".wal" : ".run"), error);
+            return true;
+        }
+
+        void syncDirectory() {
+            int fd = ::open(directory_.c_str(), O_RDONLY | O_DIRECTORY);
+            if (fd < 0) return;
+            ::fsync(fd);
+            ::close(fd);
+        }
+
+        std::string directory_;
+        LsmOptions options_;
+        bool fail_ = false;
+
+        mutable std::shared_mutex rotate_;  // writers share it, swapping the memtable takes it
+        std::shared_ptr<Memtable> memtable_;
+
+        mutable std::mutex state_;
+        std::condition_variable changed_;
+        std::deque<std::shared_ptr<const Memtable>> immutables_;  // waiting for their flush, newest first
+        std::vector<std::shared_ptr<const Run>> runs_;            // newest first
+        bool failed_ = false;
+        bool stop_ = false;
+
+        std::mutex merge_;                  // one merge at a time
+        std::thread worker_;
+    };
+}
+
+#endif // !LSM_MAP_H
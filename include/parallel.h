@@ -0,0 +1,317 @@
+#ifndef PARALLEL_H
+#define PARALLEL_H
+
+#include "binary_io.h"
+#include "serialize_binary.h"
+#include "task_pool.h"
+#include <algorithm>
+#include <atomic>
+#include <cstdint>
+#include <cstring>
+#include <iterator>
+#include <map>
+#include <memory>
+#include <set>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+// large std::vector / std::set / std::map split into independently encoded chunks of a
+// fixed number of elements, encoded and decoded on several threads. Chunk boundaries only
+// depend on chunkSize, so the bytes are the same whatever the thread count:
+//   CHUNK_MAGIC, element count, elements per chunk, chunk count, u64 each
+//   byte size of every chunk, u64 each
+//   the chunks, each the elements encoded back to back as in the container's own layout
+namespace binary {
+    constexpr uint64_t CHUNK_MAGIC = 0x31304b4e48435349;  // "ISCHNK01"
+    constexpr size_t CHUNK_HEADER = 4 * sizeof(uint64_t);
+
+    struct ParallelOptions {
+        size_t threads = std::max(1u, std::thread::hardware_concurrency());
+        size_t chunkSize = 1 << 16;  // elements per chunk, fixes the file layout
+    };
+
+    // runs work(i) for every i in [0, count) on up to threads threads, each taking the
+    // next unclaimed index
+    template <class Work>
+    void parallelFor(size_t count, size_t threads, Work work) {
+        threads = std::max<size_t>(1, std::min(threads, count));
+        std::atomic<size_t> next{0};
+        auto run = [&] {
+            for (size_t i; (i = next.fetch_add(1, std::memory_order_relaxed)) < count; ) work(i);
+        };
+        std::vector<std::thread> workers;
+        for (size_t t = 1; t < threads; t++) workers.emplace_back(run);
+        run();
+        for (auto &worker : workers) worker.join();
+    }
+
+    // allocators that are not interchangeable, e.g. std::pmr ones, usually share one
+    // memory resource, which is not safe to allocate from on several threads
+    template <class C>
+    size_t decodeThreads(size_t threads) {
+        return std::allocator_traits<typename C::allocator_type>::is_always_equal::value ? threads : 1;
+    }
+
+    template <class T, class A>
+    std::vector<typename std::vector<T, A>::const_iterator> chunkStarts(const std::vector<T, A> &value, size_t chunkSize) {
+        std::vector<typename std::vector<T, A>::const_iterator> starts;
+        for (size_t i = 0; i < value.size(); i += chunkSize) starts.push_back(value.begin() + i);
+        return starts;
+    }
+
+    template <class C>
+    std::vector<typename C::const_iterator> chunkStarts(const C &value, size_t chunkSize) {
+        std::vector<typename C::const_iterator> starts;
+        size_t i = 0;
+        for (auto it = value.begin(); it != value.end(); ++it, ++i) {
+            if (i % chunkSize == 0) starts.push_back(it);
+        }
+        return starts;
+    }
+
+    template <class F = Fixed, class C, Sink O>
+    void serializeChunked(const C &value, O &ofs, const ParallelOptions &options = {}) {
+        using T = typename C::value_type;
+        constexpr bool contiguous = std::is_same_v<C, std::vector<T, typename C::allocator_type>>;
+        if constexpr (contiguous) {
+            static_assert(!(F::columnar && FieldAccessible<T>), "columnar vectors are not split into chunks");
+        } else {
+            static_assert(!(F::packed && PackedKey<typename C::key_type>), "packed keys are not split into chunks");
+        }
+        size_t chunkSize = std::max<size_t>(1, options.chunkSize);
+        size_t count = (value.size() + chunkSize - 1) / chunkSize;
+        std::vector<uint64_t> header = {CHUNK_MAGIC, value.size(), chunkSize, count};
+        if constexpr (contiguous && blockCopied<T, F>) {
+            // the chunks are slices of the vector's own memory
+            for (size_t c = 0; c < count; c++) header.push_back(std::min(chunkSize, value.size() - c * chunkSize) * sizeof(T));
+            ofs.write(reinterpret_cast<const char *>(header.data()), header.size() * sizeof(uint64_t));
+            ofs.write(reinterpret_cast<const char *>(value.data()), value.size() * sizeof(T));
+            return;
+        }
+        auto starts = chunkStarts(value, chunkSize);
+        std::vector<Buffer> chunks(count);
+        parallelFor(count, options.threads, [&](size_t c) {
+            Formatted<Buffer, F> out(chunks[c]);
+            auto it = starts[c];
+            for (size_t i = std::min(chunkSize, value.size() - c * chunkSize); i > 0; i--, ++it) serialize(*it, out);
+        });
+        for (const auto &chunk : chunks) header.push_back(chunk.size());
+        ofs.write(reinterpret_cast<const char *>(header.data()), header.size() * sizeof(uint64_t));
+        for (const auto &chunk : chunks) ofs.write(reinterpret_cast<const char *>(chunk.data()), chunk.size());
+    }
+
+    struct ChunkDirectory {
+        uint64_t size = 0;       // elements in all chunks
+        uint64_t chunkSize = 1;  // elements per chunk but the last
+        std::vector<std::span<const std::byte>> chunks;
+    };
+
+    // false if the header does not describe bytes
+    inline bool readChunkDirectory(std::span<const std::byte> bytes, ChunkDirectory &directory) {
+        uint64_t header[4];
+        if (bytes.size() < CHUNK_HEADER) return false;
+        std::memcpy(header, bytes.data(), CHUNK_HEADER);
+        if (header[0] != CHUNK_MAGIC || header[2] == 0 || header[3] != (header[1] + header[2] - 1) / header[2] ||
+            header[3] > (bytes.size() - CHUNK_HEADER) / sizeof(uint64_t)) {
+            return false;
+        }
+        directory.size = header[1];
+        directory.chunkSize = header[2];
+        directory.chunks.resize(header[3]);
+        size_t offset = CHUNK_HEADER + header[3] * sizeof(uint64_t);
+        for (size_t c = 0; c < directory.chunks.size(); c++) {
+            uint64_t size;
+            std::memcpy(&size, bytes.data() + CHUNK_HEADER + c * sizeof(uint64_t), sizeof(size));
+            if (size > bytes.size() - offset) return false;
+            directory.chunks[c] = bytes.subspan(offset, size);
+            offset += size;
+        }
+        return true;
+    }
+
+    // decodes into a vector sized up front, every thread writing its own elements. The
+    // element count is checked against the chunk bytes before anything is allocated: a
+    // block-copied element takes sizeof(T) bytes, any other at least one
+    template <class F, class T, class A>
+    bool deserializeChunks(std::vector<T, A> &value, const ChunkDirectory &directory, const ParallelOptions &options) {
+        uint64_t bytes = 0;
+        for (const auto &chunk : directory.chunks) bytes += chunk.size();
+        if (directory.size > bytes / (blockCopied<T, F> ? sizeof(T) : 1)) return false;
+        size_t offset = F::overwrite ? 0 : value.size();
+        size_t chunkSize = directory.chunkSize;
+        value.resize(offset + directory.size);
+        std::atomic<bool> ok{true};
+        parallelFor(directory.chunks.size(), decodeThreads<std::vector<T, A>>(options.threads), [&](size_t c) {
+            size_t first = offset + c * chunkSize;
+            size_t count = std::min<size_t>(chunkSize, directory.size - c * chunkSize);
+            BufferReader reader(directory.chunks[c]);
+            Formatted<BufferReader, F> in(reader);
+            if constexpr (blockCopied<T, F>) {
+                in.read(reinterpret_cast<char *>(value.data() + first), count * sizeof(T));
+            } else {
+                for (size_t i = first; i < first + count; i++) deserialize(value[i], in);
+            }
+            if (reader.fail()) ok = false;
+        });
+        return ok;
+    }
+
+    // every thread builds the nodes of its own chunks, which are then spliced in order
+    template <class F, class C>
+    bool deserializeOrderedChunks(C &value, const ChunkDirectory &directory, const ParallelOptions &options) {
+        const auto &chunks = directory.chunks;
+        if constexpr (F::overwrite) value.clear();
+        std::vector<C> parts(chunks.size(), C(value.get_allocator()));
+        std::atomic<bool> ok{true};
+        parallelFor(chunks.size(), decodeThreads<C>(options.threads), [&](size_t c) {
+            BufferReader reader(chunks[c]);
+            Formatted<BufferReader, F> in(reader);
+            while (reader.remaining() > 0 && !reader.fail()) {
+                std::remove_const_t<typename C::key_type> key;
+                deserialize(key, in);
+                if constexpr (requires { typename C::mapped_type; }) {
+                    auto it = parts[c].emplace_hint(parts[c].end(), std::piecewise_construct,
+                                                    std::forward_as_tuple(std::move(key)), std::forward_as_tuple());
+                    deserialize(it->second, in);
+                } else {
+                    parts[c].emplace_hint(parts[c].end(), std::move(key));
+                }
+            }
+            if (reader.fail()) ok = false;
+        });
+        // keys already in value take the decoded mapped value, as insert_or_assign does
+        bool append = value.empty();
+        for (auto &part : parts) {
+            while (!part.empty()) {
+                if (append) {
+                    value.insert(value.end(), part.extract(part.begin()));
+                    continue;
+                }
+                auto result = value.insert(part.extract(part.begin()));
+                if constexpr (requires { typename C::mapped_type; }) {
+                    if (!result.inserted) result.position->second = std::move(result.node.mapped());
+                }
+            }
+        }
+        return ok;
+    }
+
+    // returns false if bytes are not a complete chunked encoding
+    template <class F = Fixed, class C>
+    bool deserializeChunked(C &value, std::span<const std::byte> bytes, const ParallelOptions &options = {}) {
+        ChunkDirectory directory;
+        if (!readChunkDirectory(bytes, directory)) return false;
+        if constexpr (requires { typename C::key_type; }) return deserializeOrderedChunks<F>(value, directory, options);
+        else return deserializeChunks<F>(value, directory, options);
+    }
+
+    template <class F = Fixed, class C>
+    void binarySerializeChunked(const C &value, const std::string &filename, const ParallelOptions &options = {}) {
+        FdSink sink(filename);
+        if (!sink) {
+            std::cerr << "Error opening file when serilization." << std::endl;
+            return;
+        }
+        serializeChunked<F>(value, sink, options);
+        if (!sink.close()) {
+            std::cerr << "Error writing file when serilization." << std::endl;
+        }
+    }
+
+    template <class F = Fixed, class C>
+    void binaryDeserializeChunked(C &value, const std::string &filename, const ParallelOptions &options = {}) {
+        MappedFile file(filename);
+        if (!file) {
+            std::cerr << "Error opening file when deserilization." << std::endl;
+            return;
+        }
+        if (!deserializeChunked<F>(value, file.bytes(), options)) {
+            std::cerr << "Error reading file when deserilization." << std::endl;
+        }
+    }
+
+    // sink for serializeParallel. Container overloads pass it their elements through
+    // serializeItems, and whenever the current thread has nothing queued it splits off
+    // the trailing half of what is left as a task with its own ParallelSink, so skewed
+    // trees are divided where they are large. The parts are stitched back in order
+    template <class F = Fixed>
+    class ParallelSink {
+    public:
+        using format = F;
+
+        explicit ParallelSink(TaskPool &pool) : pool_(pool) { segments_.emplace_back(); }
+
+        void write(const char *data, std::streamsize size) {
+            segments_.back().bytes.write(data, size);
+        }
+
+        template <class It, class Each>
+        void forEach(It first, size_t n, Each each) {
+            std::vector<std::unique_ptr<ParallelSink>> tails;
+            while (n > 0) {
+                if (n > 1 && pool_.hungry()) {
+                    size_t half = n / 2;
+                    auto tail = std::make_unique<ParallelSink>(pool_);
+                    pool_.spawn([sink = tail.get(), from = std::next(first, n - half), half, each] {
+                        serializeItems(from, half, *sink, each);
+                    });
+                    tails.push_back(std::move(tail));
+                    n -= half;
+                    continue;
+                }
+                each(*first, *this);
+                ++first;
+                --n;
+            }
+            // later splits cut earlier elements, so their output comes first
+            for (auto tail = tails.rbegin(); tail != tails.rend(); ++tail) {
+                segments_.back().tail = std::move(*tail);
+                segments_.emplace_back();
+            }
+        }
+
+        // writes everything in order, once the pool has finished
+        template <Sink O>
+        void flushTo(O &ofs) const {
+            for (const auto &segment : segments_) {
+                ofs.write(reinterpret_cast<const char *>(segment.bytes.data()), segment.bytes.size());
+                if (segment.tail) segment.tail->flushTo(ofs);
+            }
+        }
+
+    private:
+        struct Segment {
+            Buffer bytes;
+            std::unique_ptr<ParallelSink> tail;  // output of a split-off run, after bytes
+        };
+
+        TaskPool &pool_;
+        std::vector<Segment> segments_;
+    };
+
+    // same bytes as serialize(value, ofs) in format F, encoded on the pool's threads;
+    // the whole encoding is held in memory until it is written out in order
+    template <class F = Fixed, class T, Sink O>
+    void serializeParallel(const T &value, O &ofs, TaskPool &pool) {
+        ParallelSink<F> sink(pool);
+        pool.run([&] { serialize(value, sink); });
+        sink.flushTo(ofs);
+    }
+
+    template <class F = Fixed, class T>
+    void binarySerializeParallel(const T &value, const std::string &filename, TaskPool &pool) {
+        FdSink sink(filename);
+        if (!sink) {
+            std::cerr << "Error opening file when serilization." << std::endl;
+            return;
+        }
+        serializeParallel<F>(value, sink, pool);
+        if (!sink.close()) {
+            std::cerr << "Error writing file when serilization." << std::endl;
+        }
+    }
+}
+
+#endif // !PARALLEL_H
@@ -0,0 +1,145 @@
+#ifndef RANDOM_ACCESS_H
+#define RANDOM_ACCESS_H
+
+#include "binary_io.h"
+#include "serialize_binary.h"
+#include <cstdint>
+#include <cstring>
+#include <memory>
+#include <span>
+#include <string>
+#include <vector>
+
+// std::vector / std::list files with a footer index of element offsets. The container is
+// written exactly as binarySerialize writes it, so plain readers still load the whole
+// file, followed by:
+//   offset of every stride-th element, u64 each
+//   stride, element count, start of the offsets and INDEX_MAGIC, u64 each
+namespace binary {
+    constexpr uint64_t INDEX_MAGIC = 0x3130584449534942;  // "BISIDX01"
+    constexpr size_t INDEX_TRAILER = 4 * sizeof(uint64_t);
+
+    template <class F = Fixed, class C, Sink O>
+    void serializeIndexed(const C &value, O &ofs, size_t stride = 1) {
+        static_assert(!F::columnar, "columnar vectors have no per-element offsets");
+        if (stride == 0) stride = 1;
+        Counted<O> counted(ofs);
+        Formatted<Counted<O>, F> out(counted);
+        std::vector<uint64_t> offsets;
+        offsets.reserve(value.size() / stride + 1);
+        writeSize(value.size(), out);
+        size_t i = 0;
+        for (const auto &item : value) {
+            if (i++ % stride == 0) offsets.push_back(counted.size());
+            serialize(item, out);
+        }
+        uint64_t trailer[] = {stride, value.size(), counted.size(), INDEX_MAGIC};
+        ofs.write(reinterpret_cast<const char *>(offsets.data()), offsets.size() * sizeof(uint64_t));
+        ofs.write(reinterpret_cast<const char *>(trailer), sizeof(trailer));
+    }
+
+    // stride trades index size for the elements skipped to reach one: each lookup
+    // decodes at most stride - 1 elements before the one asked for
+    template <class F = Fixed, class C>
+    void binarySerializeIndexed(const C &value, const std::string &filename, size_t stride = 1) {
+        FdSink sink(filename);
+        if (!sink) {
+            std::cerr << "Error opening file when serilization." << std::endl;
+            return;
+        }
+        serializeIndexed<F>(value, sink, stride);
+        if (!sink.close()) {
+            std::cerr << "Error writing file when serilization." << std::endl;
+        }
+    }
+
+    // decodes single elements or ranges of an indexed file without touching the rest;
+    // T may be a view type such as std::string_view, pointing into the mapped file
+    template <class T, class F = Fixed>
+    class RandomAccessReader {
+    public:
+        explicit RandomAccessReader(const std::string &filename)
+            : file_(std::make_unique<MappedFile>(filename, MmapOptions{false, false})) {
+            if (file_->fail()) {
+                std::cerr << "Error opening file when deserilization." << std::endl;
+                fail_ = true;
+                return;
+            }
+            open(file_->bytes());
+        }
+
+        // borrows bytes, e.g. a Buffer filled by serializeIndexed
+        explicit RandomAccessReader(std::span<const std::byte> bytes) { open(bytes); }
+
+        bool fail() const { return fail_; }
+        explicit operator bool() const { return !fail_; }
+        size_t size() const { return size_; }
+
+        // false if i is out of range or the element is truncated
+        bool read(size_t i, T &value) const {
+            if (fail_ || i >= size_) return false;
+            BufferReader reader(bytes_.subspan(offset(i / stride_)));
+            Formatted<BufferReader, Overwrite<F>> in(reader);
+            for (size_t k = i % stride_; k > 0; k--) skip<T>(in);
+            deserialize(value, in);
+            return !reader.fail();
+        }
+
+        // appends elements [first, last) to values
+        template <class A>
+        bool read(size_t first, size_t last, std::vector<T, A> &values) const {
+            if (fail_ || first > last || last > size_) return false;
+            if (first == last) return true;
+            BufferReader reader(bytes_.subspan(offset(first / stride_)));
+            Formatted<BufferReader, Overwrite<F>> in(reader);
+            for (size_t k = first % stride_; k > 0; k--) skip<T>(in);
+            values.reserve(values.size() + (last - first));
+            for (size_t i = first; i < last; i++) {
+                if constexpr (std::is_same_v<T, bool>) {
+                    bool item;
+                    deserialize(item, in);
+                    values.push_back(item);
+                } else {
+                    deserialize(values.emplace_back(), in);
+                }
+            }
+            return !reader.fail();
+        }
+
+    private:
+        void open(std::span<const std::byte> bytes) {
+            uint64_t trailer[4];
+            if (bytes.size() < INDEX_TRAILER) {
+                fail_ = true;
+                return;
+            }
+            std::memcpy(trailer, bytes.data() + bytes.size() - INDEX_TRAILER, INDEX_TRAILER);
+            uint64_t blocks = trailer[0] == 0 ? 0 : (trailer[1] + trailer[0] - 1) / trailer[0];
+            if (trailer[3] != INDEX_MAGIC || trailer[0] == 0 || trailer[2] > bytes.size() - INDEX_TRAILER ||
+                blocks != (bytes.size() - INDEX_TRAILER - trailer[2]) / sizeof(uint64_t)) {
+                std::cerr << "Error reading index when deserilization." << std::endl;
+                fail_ = true;
+                return;
+            }
+            stride_ = trailer[0];
+            size_ = trailer[1];
+            bytes_ = bytes.first(trailer[2]);
+            index_ = bytes.data() + trailer[2];
+        }
+
+        size_t offset(size_t block) const {
+            uint64_t offset;
+            std::memcpy(&offset, index_ + block * sizeof(uint64_t), sizeof(offset));
+            return offset < bytes_.size() ? offset : bytes_.size();
+        }
+
+        std::unique_ptr<MappedFile> file_;
+        std::span<const std::byte> bytes_;
+        const std::byte *index_ = nullptr;
+        size_t stride_ = 1;
+        size_t size_ = 0;
+        bool fail_ = false;
+    };
+}
+
+#endif // !RANDOM_ACCESS_H
@@ -0,0 +1,139 @@
+#ifndef RECORD_LOG_H
+#define RECORD_LOG_H
+
+#include "binary_io.h"
+#include "generator.h"
+#include "serialize_binary.h"
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <iostream>
+#include <mutex>
+#include <span>
+#include <string>
+#include <thread>
+#include <vector>
+
+// append-only log of serialized objects. Every record is framed as
+//   payload length (u32), masked CRC-32 of the length and payload (u32), payload
+// so a torn or corrupted tail is detected and cut off when the log is reopened. The CRC
+// is masked so that zeroed space, e.g. preallocated or never written, is no valid frame.
+namespace binary {
+    uint32_t crc32(const void *data, size_t size, uint32_t crc = 0);
+
+    // the checksum stored in a frame's header
+    uint32_t frameCrc(const void *payload, uint32_t size);
+
+    // when appended records are forced to disk; with both zero that is left to the OS
+    struct LogOptions {
+        size_t syncRecords = 0;                      // fdatasync once this many records are written
+        std::chrono::milliseconds syncInterval{0};   // fdatasync in the background this often
+    };
+
+    // appends from any number of threads are batched: whichever thread finds no write in
+    // progress writes everything queued so far with one write, syncing per LogOptions,
+    // while the others wait for their record to be covered
+    class RecordLog {
+    public:
+        // opens or creates filename, scanning it for the last valid record and
+        // truncating whatever follows
+        explicit RecordLog(const std::string &filename, LogOptions options = {});
+        ~RecordLog();
+        RecordLog(const RecordLog &) = delete;
+        RecordLog &operator=(const RecordLog &) = delete;
+
+        // returns once the record has been written, and synced if the policy says so
+        template <class F = Fixed, class T>
+        bool append(const T &value) {
+            thread_local Buffer payload;
+            payload.clear();
+            Formatted<Buffer, F> out(payload);
+            serialize(value, out);
+            return appendBytes(payload.bytes());
+        }
+
+        // payloads of 4 GiB or more do not fit a frame and are rejected
+        bool appendBytes(std::span<const std::byte> payload);
+
+        // appendBytes in two steps, for callers that order records by some lock of their
+        // own: enqueue fixes the record's place in the log and returns its ticket (0 if
+        // rejected), wait(ticket) returns once it is written. Waiting outside that lock
+        // lets concurrent records share one write and sync
+        uint64_t enqueue(std::span<const std::byte> payload);
+        bool wait(uint64_t ticket);
+
+        // forces everything written so far to disk
+        bool sync();
+
+        bool fail() const { return fail_; }
+        explicit operator bool() const { return fd_ >= 0 && !fail_; }
+        uint64_t size() const {                                 // records in the log
+            std::lock_guard<std::mutex> lock(mutex_);
+            return records_;
+        }
+        uint64_t truncatedBytes() const { return truncated_; }  // cut off on open
+
+    private:
+        bool recover();
+        bool writeBatch(std::unique_lock<std::mutex> &lock);
+        void syncLoop();
+
+        int fd_ = -1;
+        bool fail_ = false;
+        LogOptions options_;
+        uint64_t truncated_ = 0;
+
+        mutable std::mutex mutex_;
+        std::condition_variable written_;
+        Buffer pending_;                // frames queued for the next batch
+        Buffer batch_;                  // frames being written
+        bool writing_ = false;
+        uint64_t records_ = 0;          // appended, queued ones included
+        uint64_t writtenRecords_ = 0;
+        uint64_t syncedRecords_ = 0;
+
+        std::thread syncer_;
+        std::condition_variable stopSyncer_;
+        bool stop_ = false;
+    };
+
+    // the raw payloads of a log, each checked against its CRC and valid until the next
+    // one is asked for; stops at the first torn or corrupted record. A length running past
+    // the end of the file is corrupt too, and is caught before anything is allocated for it
+    inline Generator<std::span<const std::byte>> logPayloads(std::string filename, StreamOptions options = {}) {
+        FdSource source(filename, options);
+        std::error_code error;
+        uint64_t left = std::filesystem::file_size(filename, error);
+        if (!source || error) {
+            std::cerr << "Error opening file when deserilization." << std::endl;
+            co_return;
+        }
+        std::vector<std::byte> payload;
+        while (!source.atEnd()) {
+            uint32_t header[2];
+            source.read(reinterpret_cast<char *>(header), sizeof(header));
+            if (source.fail() || left < sizeof(header) || header[0] > left - sizeof(header)) co_return;
+            left -= sizeof(header) + header[0];
+            payload.resize(header[0]);
+            source.read(reinterpret_cast<char *>(payload.data()), payload.size());
+            if (source.fail() || frameCrc(payload.data(), header[0]) != header[1]) co_return;
+            co_yield std::span<const std::byte>(payload);
+        }
+    }
+
+    // the records of a log, decoded one at a time through a reused object
+    template <class T, class F = Fixed>
+    Generator<T> logRecords(std::string filename, StreamOptions options = {}) {
+        T record{};
+        for (std::span<const std::byte> payload : logPayloads(filename, options)) {
+            BufferReader reader(payload);
+            Formatted<BufferReader, Overwrite<F>> in(reader);
+            deserialize(record, in);
+            if (reader.fail()) co_return;
+            co_yield record;
+        }
+    }
+}
+
+#endif // !RECORD_LOG_H
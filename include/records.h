@@ -0,0 +1,58 @@
+#ifndef RECORDS_H
+#define RECORDS_H
+
+#include "binary_io.h"
+#include "generator.h"
+#include "serialize_binary.h"
+#include <iostream>
+#include <string>
+
+// record-at-a-time scans of files too large to load. Memory stays at two StreamOptions
+// blocks plus one record: each record is decoded into the same object, reusing its
+// containers and strings, so only a reference to it is valid inside the loop body
+namespace binary {
+    // files of records encoded back to back, e.g. with serialize(record, sink) in a loop
+    //   for (const Student &s : binary::records<Student>(path)) ...
+    template <class T, class F = Fixed>
+    Generator<T> records(std::string filename, StreamOptions options = {}) {
+        FdSource source(filename, options);
+        if (!source) {
+            std::cerr << "Error opening file when deserilization." << std::endl;
+            co_return;
+        }
+        Formatted<FdSource, Overwrite<F>> in(source);
+        T record{};
+        while (!source.atEnd()) {
+            deserialize(record, in);
+            if (source.fail()) {
+                std::cerr << "Error reading file when deserilization." << std::endl;
+                co_return;
+            }
+            co_yield record;
+        }
+    }
+
+    // the elements of a std::vector<T> or std::list<T> written by binarySerialize
+    template <class T, class F = Fixed>
+    Generator<T> elements(std::string filename, StreamOptions options = {}) {
+        static_assert(!(F::columnar && FieldAccessible<T>), "columnar vectors are not stored element by element");
+        FdSource source(filename, options);
+        if (!source) {
+            std::cerr << "Error opening file when deserilization." << std::endl;
+            co_return;
+        }
+        Formatted<FdSource, Overwrite<F>> in(source);
+        T element{};
+        for (size_t size = readSize(in); size > 0 && !source.fail(); size--) {
+            if constexpr (blockCopied<T, F>) in.read(reinterpret_cast<char *>(&element), sizeof(T));
+            else deserialize(element, in);
+            if (source.fail()) {
+                std::cerr << "Error reading file when deserilization." << std::endl;
+                co_return;
+            }
+            co_yield element;
+        }
+    }
+}
+
+#endif // !RECORDS_H
@@ -0,0 +1,257 @@
+#ifndef SEARCH_TREE_H
+#define SEARCH_TREE_H
+
+#include "binary_io.h"
+#include "serialize_binary.h"
+#include <bit>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <memory>
+#include <optional>
+#include <span>
+#include <string>
+#include <type_traits>
+#include <vector>
+
+// std::set / std::map files with fixed-width keys in Eytzinger order: node k of an implicit
+// binary search tree has its children at 2k and 2k + 1, so a lookup walks down the array
+// touching one cache line per level for the top levels and prefetching the ones below.
+// Lookups run directly against the mapped file, nothing is decoded up front:
+//   keys, slot 0 unused then one per node, on a 64-byte boundary
+//   values in the same node order, on a 64-byte boundary: raw values when V is block
+//     copyable, otherwise a u64 offset per node followed by the serialized values in
+//     key order
+//   count, start of the keys, start of the values (0 for a set), key width, value width
+//     (0 when serialized) and TREE_MAGIC, u64 each
+namespace binary {
+    constexpr uint64_t TREE_MAGIC = 0x3145455254534942;  // "BISTREE1"
+    constexpr size_t TREE_TRAILER = 6 * sizeof(uint64_t);
+    constexpr size_t TREE_ALIGN = 64;
+
+    template <class T>
+    struct is_map_like : std::false_type {};
+
+    template <class T> requires requires { typename T::mapped_type; }
+    struct is_map_like<T> : std::true_type {};
+
+    namespace eytzinger {
+        // node of the smallest key in an n-node tree, 0 if empty
+        inline size_t first(size_t n) {
+            if (n == 0) return 0;
+            size_t k = 1;
+            while (2 * k <= n) k *= 2;
+            return k;
+        }
+
+        // in-order successor: the leftmost node of the right subtree, or else the
+        // nearest ancestor whose left subtree holds k; 0 past the last node
+        inline size_t next(size_t k, size_t n) {
+            if (2 * k + 1 <= n) {
+                k = 2 * k + 1;
+                while (2 * k <= n) k *= 2;
+                return k;
+            }
+            return k >> (std::countr_one(k) + 1);
+        }
+    }
+
+    template <class F = Fixed, class C, Sink O>
+    void serializeSearchTree(const C &value, O &ofs) {
+        using K = typename C::key_type;
+        static_assert(Arithmetic<K>, "search tree keys must be fixed-width numbers");
+        Counted<O> counted(ofs);
+        Formatted<Counted<O>, F> out(counted);
+        auto pad = [&counted] {
+            static constexpr char zeros[TREE_ALIGN] = {};
+            size_t extra = counted.size() % TREE_ALIGN;
+            if (extra != 0) counted.write(zeros, TREE_ALIGN - extra);
+        };
+
+        // an in-order walk of the tree visits the nodes in key order
+        size_t n = value.size();
+        std::vector<K> keys(n + 1);
+        size_t k = eytzinger::first(n);
+        for (const auto &item : value) {
+            if constexpr (is_map_like<C>::value) {
+                keys[k] = item.first;
+            } else {
+                keys[k] = item;
+            }
+            k = eytzinger::next(k, n);
+        }
+        pad();
+        uint64_t keysStart = counted.size();
+        counted.write(reinterpret_cast<const char *>(keys.data()), keys.size() * sizeof(K));
+
+        uint64_t valuesStart = 0;
+        uint64_t valueWidth = 0;
+        if constexpr (is_map_like<C>::value) {
+            using V = typename C::mapped_type;
+            pad();
+            valuesStart = counted.size();
+            if constexpr (BulkCopyable<V>) {
+                valueWidth = sizeof(V);
+                std::vector<V> values(n + 1);
+                k = eytzinger::first(n);
+                for (const auto &[key, item] : value) {
+                    values[k] = item;
+                    k = eytzinger::next(k, n);
+                }
+                counted.write(reinterpret_cast<const char *>(values.data()), values.size() * sizeof(V));
+            } else {
+                std::vector<uint64_t> offsets(n + 1);
+                uint64_t offset = 0;
+                k = eytzinger::first(n);
+                for (const auto &[key, item] : value) {
+                    offsets[k] = offset;
+                    offset += serializedSize<F>(item);
+                    k = eytzinger::next(k, n);
+                }
+                counted.write(reinterpret_cast<const char *>(offsets.data()), offsets.size() * sizeof(uint64_t));
+                for (const auto &[key, item] : value) serialize(item, out);
+            }
+        }
+        uint64_t trailer[] = {n, keysStart, valuesStart, sizeof(K), valueWidth, TREE_MAGIC};
+        counted.write(reinterpret_cast<const char *>(trailer), sizeof(trailer));
+    }
+
+    template <class F = Fixed, class C>
+    void binarySerializeSearchTree(const C &value, const std::string &filename) {
+        FdSink sink(filename);
+        if (!sink) {
+            std::cerr << "Error opening file when serilization." << std::endl;
+            return;
+        }
+        serializeSearchTree<F>(value, sink);
+        if (!sink.close()) {
+            std::cerr << "Error writing file when serilization." << std::endl;
+        }
+    }
+
+    // find / lower_bound over a search tree file without loading it; V = void for a set.
+    // Serialized values are decoded on access, V may be a view type such as
+    // std::string_view pointing into the mapped file
+    template <Arithmetic K, class V = void, class F = Fixed>
+    class SearchTree {
+    public:
+        // a position in key order; end() is node 0
+        class iterator {
+        public:
+            iterator() = default;
+
+            const K &key() const { return tree_->keys_[k_]; }
+
+            V value() const requires (!std::is_void_v<V>) { return tree_->value(k_); }
+
+            iterator &operator++() {
+                k_ = eytzinger::next(k_, tree_->size_);
+                return *this;
+            }
+
+            bool operator==(const iterator &other) const { return k_ == other.k_; }
+
+        private:
+            friend class SearchTree;
+            iterator(const SearchTree *tree, size_t k) : tree_(tree), k_(k) {}
+
+            const SearchTree *tree_ = nullptr;
+            size_t k_ = 0;
+        };
+
+        explicit SearchTree(const std::string &filename)
+            : file_(std::make_unique<MappedFile>(filename, MmapOptions{false, false})) {
+            if (file_->fail()) {
+                std::cerr << "Error opening file when deserilization." << std::endl;
+                fail_ = true;
+                return;
+            }
+            open(file_->bytes());
+        }
+
+        // borrows bytes, e.g. a Buffer filled by serializeSearchTree
+        explicit SearchTree(std::span<const std::byte> bytes) { open(bytes); }
+
+        bool fail() const { return fail_; }
+        explicit operator bool() const { return !fail_; }
+        size_t size() const { return size_; }
+
+        iterator begin() const { return iterator(this, eytzinger::first(size_)); }
+
+        iterator end() const { return iterator(this, 0); }
+
+        // first key not less than key
+        iterator lower_bound(const K &key) const {
+            size_t k = 1;
+            while (k <= size_) {
+                __builtin_prefetch(keys_ + k * (TREE_ALIGN / sizeof(K)));
+                k = 2 * k + (keys_[k] < key);
+            }
+            return iterator(this, k >> (std::countr_one(k) + 1));
+        }
+
+        iterator find(const K &key) const {
+            iterator it = lower_bound(key);
+            return it != end() && !(key < it.key()) ? it : end();
+        }
+
+        bool contains(const K &key) const { return find(key) != end(); }
+
+        std::optional<V> get(const K &key) const requires (!std::is_void_v<V>) {
+            iterator it = find(key);
+            if (it == end()) return std::nullopt;
+            return value(it.k_);
+        }
+
+    private:
+        void open(std::span<const std::byte> bytes) {
+            uint64_t trailer[6];
+            if (bytes.size() < TREE_TRAILER) {
+                fail_ = true;
+                return;
+            }
+            std::memcpy(trailer, bytes.data() + bytes.size() - TREE_TRAILER, TREE_TRAILER);
+            uint64_t end = bytes.size() - TREE_TRAILER;
+            bool map = trailer[2] != 0;
+            bool valid = trailer[5] == TREE_MAGIC && trailer[3] == sizeof(K) && map == !std::is_void_v<V> &&
+                         trailer[1] <= end && reinterpret_cast<uintptr_t>(bytes.data() + trailer[1]) % alignof(K) == 0 &&
+                         trailer[0] < (end - trailer[1]) / sizeof(K);
+            if constexpr (!std::is_void_v<V>) {
+                uint64_t width = BulkCopyable<V> ? sizeof(V) : sizeof(uint64_t);
+                valid = valid && trailer[4] == (BulkCopyable<V> ? sizeof(V) : 0) && trailer[2] <= end &&
+                        trailer[0] < (end - trailer[2]) / width;
+            }
+            if (!valid) {
+                std::cerr << "Error reading index when deserilization." << std::endl;
+                fail_ = true;
+                return;
+            }
+            size_ = trailer[0];
+            keys_ = reinterpret_cast<const K *>(bytes.data() + trailer[1]);
+            values_ = bytes.subspan(trailer[2], end - trailer[2]);
+        }
+
+        V value(size_t k) const requires (!std::is_void_v<V>) {
+            V value{};
+            if constexpr (BulkCopyable<V>) {
+                std::memcpy(&value, values_.data() + k * sizeof(V), sizeof(V));
+            } else {
+                uint64_t offset;
+                std::memcpy(&offset, values_.data() + k * sizeof(uint64_t), sizeof(offset));
+                size_t data = (size_ + 1) * sizeof(uint64_t);
+                BufferReader reader(values_.subspan(std::min<size_t>(data + offset, values_.size())));
+                Formatted<BufferReader, F> in(reader);
+                deserialize(value, in);
+            }
+            return value;
+        }
+
+        std::unique_ptr<MappedFile> file_;
+        const K *keys_ = nullptr;
+        std::span<const std::byte> values_;
+        size_t size_ = 0;
+        bool fail_ = false;
+    };
+}
+
+#endif // !SEARCH_TREE_H
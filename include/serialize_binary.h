@@ -1,15 +1,24 @@
 #ifndef SERIALIZE_BINARY_H
 #define SERIALIZE_BINARY_H
 
+#include "binary_io.h"
+#include "bitpack.h"
+#include <algorithm>
 #include <cstddef>
+#include <cstdint>
 #include <ios>
 #include <iostream>
 #include <fstream>
 #include <list>
 #include <map>
 #include <memory>
+#include <memory_resource>
 #include <set>
+#include <span>
 #include <string>
+#include <string_view>
+#include <tuple>
+#include <unordered_map>
 #include <vector>
 #include <type_traits>
 #include <utility>
@@ -18,165 +27,969 @@ namespace binary {
     template <class T>
     concept Arithmetic = std::is_arithmetic_v<T>;
 
+    // types whose in-memory representation is exactly their serialized layout,
+    // so contiguous runs of them can be written and read as a single block
+    template <class T>
+    struct is_bulk_copyable : std::bool_constant<std::is_arithmetic_v<T>> {};
+
+    // GENERATE_SERIALIZATION classes whose listed fields cover them without padding
+    template <class T> requires (std::is_class_v<T> && requires { T::template serialization_packed<T>(); })
+    struct is_bulk_copyable<T> : std::bool_constant<T::template serialization_packed<T>()> {};
+
+    // std::vector<bool> is bit-packed and has no data(), so it never takes the block path
+    template <class T>
+    concept BulkCopyable = is_bulk_copyable<T>::value && !std::is_same_v<T, bool>;
+
+    // classes using GENERATE_SERIALIZATION
+    template <class T, class O>
+    concept SerializableTo = requires(const T &value, O &ofs) { value.serializeTo(ofs); };
+
+    template <class T, class I>
+    concept DeserializableFrom = requires(T &value, I &ifs) { value.deserializeFrom(ifs); };
+
+    // GENERATE_SERIALIZATION classes expose their listed fields as a tuple of references;
+    // tagged classes are kept row by row so that their fields stay self-describing
+    template <class T>
+    concept FieldAccessible = requires(const T &value) { value.serialization_fields(); } && !T::serialization_tagged();
+
+    // integers that Compact encodes as varints; single bytes gain nothing from it
+    template <class T>
+    concept VarintEncoded = std::is_integral_v<T> && !std::is_same_v<T, bool> && sizeof(T) > 1;
+
+    // set and map keys that Packed stores as delta-coded, bit-packed blocks
+    template <class T>
+    concept PackedKey = std::is_integral_v<T> && !std::is_same_v<T, bool>;
+
+    // std::vector<T> elements that format F stores as one block of raw memory
+    template <class T, class F>
+    constexpr bool blockCopied = BulkCopyable<T> && !(F::varint && (VarintEncoded<T> || std::is_class_v<T>));
+
+    // every overload is declared up front so nested containers resolve regardless of
+    // definition order, whatever namespace the sink or source lives in
+    template <Arithmetic T, Sink O> void serialize(const T &value, O &ofs);
+    template <Arithmetic T, Source I> void deserialize(T &value, I &ifs);
+    template <class Tr, class A, Sink O> void serialize(const std::basic_string<char, Tr, A> &value, O &ofs);
+    template <class Tr, class A, Source I> void deserialize(std::basic_string<char, Tr, A> &value, I &ifs);
+    template <Sink O> void serialize(const std::string_view &value, O &ofs);
+    template <ViewSource I> void deserialize(std::string_view &value, I &ifs);
+    template <class T1, class T2, Sink O> void serialize(const std::pair<T1, T2> &value, O &ofs);
+    template <class T1, class T2, Source I> void deserialize(std::pair<T1, T2> &value, I &ifs);
+    template <class T, class A, Sink O> void serialize(const std::vector<T, A> &value, O &ofs);
+    template <class T, class A, Source I> void deserialize(std::vector<T, A> &value, I &ifs);
+    template <BulkCopyable T, class A, Sink O> void serialize(const std::vector<T, A> &value, O &ofs);
+    template <BulkCopyable T, class A, Source I> void deserialize(std::vector<T, A> &value, I &ifs);
+    template <BulkCopyable T, Sink O> void serialize(const std::span<const T> &value, O &ofs);
+    template <BulkCopyable T, ViewSource I> void deserialize(std::span<const T> &value, I &ifs);
+    template <class T, class A, Sink O> void serialize(const std::list<T, A> &value, O &ofs);
+    template <class T, class A, Source I> void deserialize(std::list<T, A> &value, I &ifs);
+    template <class T, class C, class A, Sink O> void serialize(const std::set<T, C, A> &value, O &ofs);
+    template <class T, class C, class A, Source I> void deserialize(std::set<T, C, A> &value, I &ifs);
+    template <class T1, class T2, class C, class A, Sink O> void serialize(const std::map<T1, T2, C, A> &value, O &ofs);
+    template <class T1, class T2, class C, class A, Source I> void deserialize(std::map<T1, T2, C, A> &value, I &ifs);
+    template <class T, Sink O> void serialize(const std::unique_ptr<T> &value, O &ofs);
+    template <class T, Source I> void deserialize(std::unique_ptr<T> &value, I &ifs);
+    template <class T, Sink O> requires SerializableTo<T, O> void serialize(const T &value, O &ofs);
+    template <class T, Source I> requires DeserializableFrom<T, I> void deserialize(T &value, I &ifs);
+
+    // LEB128: 7 bits per byte, high bit set on every byte but the last
+    template <Sink O>
+    void writeVarint(uint64_t value, O &ofs) {
+        char bytes[10];
+        int size = 0;
+        while (value >= 0x80) {
+            bytes[size++] = static_cast<char>(value | 0x80);
+            value >>= 7;
+        }
+        bytes[size++] = static_cast<char>(value);
+        ofs.write(bytes, size);
+    }
+
+    template <Source I>
+    uint64_t readVarint(I &ifs) {
+        uint64_t value = 0;
+        for (int shift = 0; shift < 64; shift += 7) {
+            unsigned char byte = 0;
+            ifs.read(reinterpret_cast<char *>(&byte), 1);
+            value |= static_cast<uint64_t>(byte & 0x7f) << shift;
+            if (!(byte & 0x80)) break;
+        }
+        return value;
+    }
+
+    // zigzag maps small negative and positive numbers alike to small unsigned ones
+    template <VarintEncoded T>
+    uint64_t zigzag(T value) {
+        if constexpr (std::is_signed_v<T>) {
+            using U = std::make_unsigned_t<T>;
+            return static_cast<U>(static_cast<U>(value) << 1) ^ static_cast<U>(value >> (sizeof(T) * 8 - 1));
+        } else {
+            return value;
+        }
+    }
+
+    template <VarintEncoded T>
+    T unzigzag(uint64_t value) {
+        if constexpr (std::is_signed_v<T>) {
+            return static_cast<T>((value >> 1) ^ (~(value & 1) + 1));
+        } else {
+            return static_cast<T>(value);
+        }
+    }
+
+    // container and string length prefixes
+    template <Sink O>
+    void writeSize(size_t size, O &ofs) {
+        if constexpr (format_t<O>::varint) writeVarint(size, ofs);
+        else ofs.write(reinterpret_cast<const char *>(&size), sizeof(size));
+    }
+
+    template <Source I>
+    size_t readSize(I &ifs) {
+        size_t size = 0;
+        if constexpr (format_t<I>::varint) size = readVarint(ifs);
+        else ifs.read(reinterpret_cast<char *>(&size), sizeof(size));
+        return size;
+    }
+
+    // readSize for a count of elements that take at least bytes per elements of them. A
+    // source that knows how much it has left fails on a count that cannot fit, and 0 is
+    // returned, so a corrupt prefix never reaches resize or reserve
+    template <Source I>
+    size_t readLength(I &ifs, size_t bytes = 1, size_t elements = 1) {
+        size_t size = readSize(ifs);
+        if constexpr (requires { ifs.remaining(); }) {
+            if (size / elements > ifs.remaining() / bytes) {
+                ifs.view(SIZE_MAX);
+                return 0;
+            }
+        }
+        return size;
+    }
+
+    // per block of bitpack::BLOCK values: the first as a plain T, then a width byte and
+    // the gaps to each following value packed at that width. Ascending keys store gaps
+    // as they are; Signed zigzags them so unsorted columns stay small too
+    template <PackedKey T, bool Signed = false, class It, class Key, Sink O>
+    void serializePackedKeys(It it, size_t size, Key key, O &ofs) {
+        using U = std::make_unsigned_t<T>;
+        uint64_t gaps[bitpack::BLOCK];
+        uint64_t words[bitpack::BLOCK];
+        for (size_t done = 0; done < size; ) {
+            size_t n = std::min(bitpack::BLOCK, size - done);
+            T prev = key(*it++);
+            serialize(prev, ofs);
+            for (size_t i = 1; i < n; i++, it++) {
+                T cur = key(*it);
+                U gap = static_cast<U>(cur) - static_cast<U>(prev);
+                if constexpr (Signed) gaps[i - 1] = zigzag(static_cast<std::make_signed_t<T>>(gap));
+                else gaps[i - 1] = gap;
+                prev = cur;
+            }
+            int bits = bitpack::width(gaps, n - 1);
+            char width = static_cast<char>(bits);
+            ofs.write(&width, 1);
+            bitpack::pack(gaps, n - 1, bits, words);
+            ofs.write(reinterpret_cast<const char *>(words), bitpack::words(n - 1, bits) * sizeof(uint64_t));
+            done += n;
+        }
+    }
+
+    // calls emit(key) for each of size keys, in order
+    template <PackedKey T, bool Signed = false, Source I, class Emit>
+    void deserializePackedKeys(size_t size, I &ifs, Emit emit) {
+        using U = std::make_unsigned_t<T>;
+        uint64_t gaps[bitpack::BLOCK];
+        uint64_t words[bitpack::BLOCK];
+        for (size_t done = 0; done < size; ) {
+            size_t n = std::min(bitpack::BLOCK, size - done);
+            T prev{};
+            deserialize(prev, ifs);
+            emit(prev);
+            unsigned char width = 0;
+            ifs.read(reinterpret_cast<char *>(&width), 1);
+            int bits = std::min<int>(width, 64);
+            ifs.read(reinterpret_cast<char *>(words), bitpack::words(n - 1, bits) * sizeof(uint64_t));
+            bitpack::unpack(words, n - 1, bits, gaps);
+            for (size_t i = 0; i + 1 < n; i++) {
+                U gap;
+                if constexpr (Signed) gap = static_cast<U>(unzigzag<std::make_signed_t<T>>(gaps[i]));
+                else gap = static_cast<U>(gaps[i]);
+                prev = static_cast<T>(static_cast<U>(static_cast<U>(prev) + gap));
+                emit(prev);
+            }
+            done += n;
+        }
+    }
+
+    // Overwrite moves the old nodes of a set or map aside and decodes into them one at a
+    // time, so node allocations and the storage inside elements are reused
+    template <class C>
+    typename C::node_type spareNode(C &spare) {
+        if (spare.empty()) return {};
+        return spare.extract(spare.begin());
+    }
+
     // std::is_arithmetic
-    template <Arithmetic T>
-    void serialize(const T &value, std::ofstream &ofs) {
-        ofs.write(reinterpret_cast<const char *>(&value), sizeof(T));
+    template <Arithmetic T, Sink O>
+    void serialize(const T &value, O &ofs) {
+        if constexpr (format_t<O>::varint && VarintEncoded<T>) writeVarint(zigzag(value), ofs);
+        else ofs.write(reinterpret_cast<const char *>(&value), sizeof(T));
     }
 
-    template <Arithmetic T>
-    void deserialize(T &value, std::ifstream &ifs) {
-        ifs.read(reinterpret_cast<char *>(&value), sizeof(T));
+    template <Arithmetic T, Source I>
+    void deserialize(T &value, I &ifs) {
+        if constexpr (format_t<I>::varint && VarintEncoded<T>) value = unzigzag<T>(readVarint(ifs));
+        else ifs.read(reinterpret_cast<char *>(&value), sizeof(T));
     }
 
     // std::string
-    inline void serialize(const std::string &value, std::ofstream &ofs) {
+    template <class Tr, class A, Sink O>
+    void serialize(const std::basic_string<char, Tr, A> &value, O &ofs) {
         size_t size = value.size();
-        ofs.write(reinterpret_cast<const char *>(&size), sizeof(size));
+        writeSize(size, ofs);
         ofs.write(value.c_str(), size);
     }
 
-    inline void deserialize(std::string &value, std::ifstream &ifs) {
-        size_t size;
-        ifs.read(reinterpret_cast<char *>(&size), sizeof(size));
+    template <class Tr, class A, Source I>
+    void deserialize(std::basic_string<char, Tr, A> &value, I &ifs) {
+        size_t size = readLength(ifs);
         value.resize(size);
         ifs.read(&value[0], size);
     }
 
+    // std::string_view, same layout as std::string; decoding points into the source
+    template <Sink O>
+    void serialize(const std::string_view &value, O &ofs) {
+        size_t size = value.size();
+        writeSize(size, ofs);
+        ofs.write(value.data(), size);
+    }
+
+    template <ViewSource I>
+    void deserialize(std::string_view &value, I &ifs) {
+        size_t size = readSize(ifs);
+        const std::byte *data = ifs.view(size);
+        if (data == nullptr) value = {};
+        else value = {reinterpret_cast<const char *>(data), size};
+    }
+
     // std::pair<T1, T2>
-    template<class T1, class T2>
-    void serialize(const std::pair<T1, T2> &value, std::ofstream &ofs) {
+    template<class T1, class T2, Sink O>
+    void serialize(const std::pair<T1, T2> &value, O &ofs) {
         serialize(value.first, ofs);
         serialize(value.second, ofs);
     }
 
-    template<class T1, class T2>
-    void deserialize(std::pair<T1, T2> &value, std::ifstream &ifs) {
+    template<class T1, class T2, Source I>
+    void deserialize(std::pair<T1, T2> &value, I &ifs) {
         deserialize(value.first, ifs);
         deserialize(value.second, ifs);
     }
 
+    // each(item, ofs) over the n items from first, in order; a sink that can fork, e.g.
+    // a ParallelSink, may hand trailing runs of them to other threads and stitch their
+    // output back in place
+    template <class It, Sink O, class Each>
+    void serializeItems(It first, size_t n, O &ofs, Each each) {
+        if constexpr (requires { ofs.forEach(first, n, each); }) {
+            ofs.forEach(first, n, each);
+        } else {
+            for (; n > 0; n--, ++first) each(*first, ofs);
+        }
+    }
+
+    // columns of fixed-width values, gathered through a small stack block so that each
+    // block is one write; varint formats encode integers one by one instead
+    template <BulkCopyable F, Sink O, class Get>
+    void serializeBulkColumn(size_t size, Get get, O &ofs) {
+        if constexpr (format_t<O>::varint && VarintEncoded<F>) {
+            for (size_t i = 0; i < size; i++) writeVarint(zigzag(static_cast<F>(get(i))), ofs);
+        } else {
+            F block[512];
+            for (size_t done = 0; done < size; ) {
+                size_t n = std::min<size_t>(512, size - done);
+                for (size_t i = 0; i < n; i++) block[i] = get(done + i);
+                ofs.write(reinterpret_cast<const char *>(block), n * sizeof(F));
+                done += n;
+            }
+        }
+    }
+
+    template <BulkCopyable F, Source I, class Put>
+    void deserializeBulkColumn(size_t size, Put put, I &ifs) {
+        if constexpr (format_t<I>::varint && VarintEncoded<F>) {
+            for (size_t i = 0; i < size; i++) put(i, unzigzag<F>(readVarint(ifs)));
+        } else {
+            F block[512];
+            for (size_t done = 0; done < size; ) {
+                size_t n = std::min<size_t>(512, size - done);
+                ifs.read(reinterpret_cast<char *>(block), n * sizeof(F));
+                for (size_t i = 0; i < n; i++) put(done + i, block[i]);
+                done += n;
+            }
+        }
+    }
+
+    template <class T>
+    struct is_string : std::false_type {};
+
+    template <class Tr, class A>
+    struct is_string<std::basic_string<char, Tr, A>> : std::true_type {};
+
+    // one field of every row: integers are delta coded under packed formats, other
+    // fixed-width values are written as a block, strings repeating often enough get a
+    // dictionary, and anything else falls back to one value per row
+    template <class F, class Rows, class Get, Sink O>
+    void serializeColumn(const Rows &rows, Get get, O &ofs) {
+        size_t size = rows.size();
+        if constexpr (format_t<O>::packed && VarintEncoded<F>) {
+            serializePackedKeys<F, true>(rows.begin(), size, get, ofs);
+        } else if constexpr (BulkCopyable<F> && !std::is_class_v<F>) {
+            serializeBulkColumn<F>(size, [&](size_t i) { return get(rows[i]); }, ofs);
+        } else if constexpr (is_string<F>::value) {
+            std::unordered_map<std::string_view, uint32_t> ids;
+            std::vector<std::string_view> dictionary;
+            std::vector<uint32_t> indices(size);
+            for (size_t i = 0; i < size && dictionary.size() * 2 <= size; i++) {
+                auto [it, added] = ids.try_emplace(std::string_view(get(rows[i])), static_cast<uint32_t>(dictionary.size()));
+                if (added) dictionary.push_back(it->first);
+                indices[i] = it->second;
+            }
+            char useDictionary = dictionary.size() * 2 <= size;
+            ofs.write(&useDictionary, 1);
+            if (!useDictionary) {
+                for (size_t i = 0; i < size; i++) serialize(get(rows[i]), ofs);
+                return;
+            }
+            serialize(dictionary, ofs);
+            serializeBulkColumn<uint32_t>(size, [&](size_t i) { return indices[i]; }, ofs);
+        } else {
+            for (size_t i = 0; i < size; i++) serialize(get(rows[i]), ofs);
+        }
+    }
+
+    template <class F, class Rows, class Get, Source I>
+    void deserializeColumn(Rows &rows, size_t offset, Get get, I &ifs) {
+        size_t size = rows.size() - offset;
+        if constexpr (format_t<I>::packed && VarintEncoded<F>) {
+            size_t i = offset;
+            deserializePackedKeys<F, true>(size, ifs, [&](F item) { get(rows[i++]) = item; });
+        } else if constexpr (BulkCopyable<F> && !std::is_class_v<F>) {
+            deserializeBulkColumn<F>(size, [&](size_t i, F item) { get(rows[offset + i]) = item; }, ifs);
+        } else if constexpr (is_string<F>::value) {
+            char useDictionary = 0;
+            ifs.read(&useDictionary, 1);
+            if (!useDictionary) {
+                for (size_t i = offset; i < rows.size(); i++) deserialize(get(rows[i]), ifs);
+                return;
+            }
+            std::vector<std::string> dictionary;
+            deserialize(dictionary, ifs);
+            deserializeBulkColumn<uint32_t>(size, [&](size_t i, uint32_t id) {
+                if (id < dictionary.size()) get(rows[offset + i]).assign(dictionary[id].data(), dictionary[id].size());
+            }, ifs);
+        } else {
+            for (size_t i = offset; i < rows.size(); i++) deserialize(get(rows[i]), ifs);
+        }
+    }
+
+    // std::vector of a GENERATE_SERIALIZATION class under a columnar format: the length,
+    // then every listed field as its own column, in listing order
+    template <class T, class A, Sink O>
+    void serializeColumns(const std::vector<T, A> &value, O &ofs) {
+        using Fields = decltype(std::declval<const T &>().serialization_fields());
+        writeSize(value.size(), ofs);
+        [&]<size_t... K>(std::index_sequence<K...>) {
+            (serializeColumn<std::remove_cvref_t<std::tuple_element_t<K, Fields>>>(value,
+                [](const T &row) -> const auto & { return std::get<K>(row.serialization_fields()); }, ofs), ...);
+        }(std::make_index_sequence<std::tuple_size_v<Fields>>());
+    }
+
+    template <class T, class A, Source I>
+    void deserializeColumns(std::vector<T, A> &value, I &ifs) {
+        using Fields = decltype(std::declval<T &>().serialization_fields());
+        size_t size = readSize(ifs);
+        size_t offset = format_t<I>::overwrite ? 0 : value.size();
+        value.resize(offset + size);
+        [&]<size_t... K>(std::index_sequence<K...>) {
+            (deserializeColumn<std::remove_cvref_t<std::tuple_element_t<K, Fields>>>(value, offset,
+                [](T &row) -> auto & { return std::get<K>(row.serialization_fields()); }, ifs), ...);
+        }(std::make_index_sequence<std::tuple_size_v<Fields>>());
+    }
+
     // std::vector<T>
-    template<class T>
-    void serialize(const std::vector<T> &value, std::ofstream &ofs) {
+    template<class T, class A, Sink O>
+    void serialize(const std::vector<T, A> &value, O &ofs) {
+        if constexpr (format_t<O>::columnar && FieldAccessible<T>) {
+            serializeColumns(value, ofs);
+            return;
+        }
         size_t size = value.size();
-        ofs.write(reinterpret_cast<const char *>(&size), sizeof(size));
+        writeSize(size, ofs);
+        serializeItems(value.begin(), size, ofs, [](const auto &item, auto &out) { serialize(item, out); });
+    }
+
+    // elements are decoded directly in their final slot, never copied
+    template<class T, class A, Source I>
+    void deserialize(std::vector<T, A> &value, I &ifs) {
+        if constexpr (format_t<I>::columnar && FieldAccessible<T>) {
+            deserializeColumns(value, ifs);
+            return;
+        }
+        size_t size = readLength(ifs);
+        if constexpr (format_t<I>::overwrite) {
+            value.resize(size);
+            for (size_t i = 0; i < size; i++) {
+                if constexpr (std::is_same_v<T, bool>) {
+                    bool item;
+                    deserialize(item, ifs);
+                    value[i] = item;
+                } else {
+                    deserialize(value[i], ifs);
+                }
+            }
+            return;
+        }
+        value.reserve(value.size() + size);
         for (int i = 0; i < size; i++) {
-            serialize(value[i], ofs);
+            if constexpr (std::is_same_v<T, bool>) {
+                // std::vector<bool> hands out proxies, which cannot be decoded into
+                bool item;
+                deserialize(item, ifs);
+                value.push_back(item);
+            } else {
+                deserialize(value.emplace_back(), ifs);
+            }
         }
     }
 
-    template<class T>
-    void deserialize(std::vector<T> &value, std::ifstream &ifs) {
-        size_t size;
-        ifs.read(reinterpret_cast<char *>(&size), sizeof(size));
-        for (int i = 0; i < size; i++) {
-            T item;
-            deserialize(item, ifs);
-            value.push_back(item);
+    // packed classes hold integers of their own, which varint formats encode one by one
+    template<BulkCopyable T, class A, Sink O>
+    void serialize(const std::vector<T, A> &value, O &ofs) {
+        if constexpr (format_t<O>::columnar && FieldAccessible<T>) {
+            serializeColumns(value, ofs);
+            return;
+        }
+        size_t size = value.size();
+        writeSize(size, ofs);
+        if constexpr (format_t<O>::varint && VarintEncoded<T>) {
+            for (size_t i = 0; i < size; i++) writeVarint(zigzag(value[i]), ofs);
+        } else if constexpr (format_t<O>::varint && std::is_class_v<T>) {
+            for (size_t i = 0; i < size; i++) serialize(value[i], ofs);
+        } else {
+            ofs.write(reinterpret_cast<const char *>(value.data()), size * sizeof(T));
         }
     }
 
-    // std::list<T>
-    template<class T>
-    void serialize(const std::list<T> &value, std::ofstream &ofs) {
+    template<BulkCopyable T, class A, Source I>
+    void deserialize(std::vector<T, A> &value, I &ifs) {
+        if constexpr (format_t<I>::columnar && FieldAccessible<T>) {
+            deserializeColumns(value, ifs);
+            return;
+        }
+        size_t size = readLength(ifs, format_t<I>::varint ? 1 : sizeof(T));
+        size_t offset = format_t<I>::overwrite ? 0 : value.size();
+        value.resize(offset + size);
+        if constexpr (format_t<I>::varint && VarintEncoded<T>) {
+            for (size_t i = offset; i < offset + size; i++) value[i] = unzigzag<T>(readVarint(ifs));
+        } else if constexpr (format_t<I>::varint && std::is_class_v<T>) {
+            for (size_t i = offset; i < offset + size; i++) deserialize(value[i], ifs);
+        } else {
+            ifs.read(reinterpret_cast<char *>(value.data() + offset), size * sizeof(T));
+        }
+    }
+
+    // std::span<const T>, same layout as std::vector<T>; decoding points into the source,
+    // which fails if the elements are not suitably aligned there
+    template<BulkCopyable T, Sink O>
+    void serialize(const std::span<const T> &value, O &ofs) {
         size_t size = value.size();
-        ofs.write(reinterpret_cast<const char *>(&size), sizeof(size));
-        for (auto item = value.begin(); item != value.end(); item++) {
-            serialize(*item, ofs);
+        writeSize(size, ofs);
+        if constexpr (format_t<O>::varint && VarintEncoded<T>) {
+            for (size_t i = 0; i < size; i++) writeVarint(zigzag(value[i]), ofs);
+        } else if constexpr (format_t<O>::varint && std::is_class_v<T>) {
+            for (size_t i = 0; i < size; i++) serialize(value[i], ofs);
+        } else {
+            ofs.write(reinterpret_cast<const char *>(value.data()), size * sizeof(T));
         }
     }
 
-    template<class T>
-    void deserialize(std::list<T> &value, std::ifstream &ifs) {
-        size_t size;
-        ifs.read(reinterpret_cast<char *>(&size), sizeof(size));
+    template<BulkCopyable T, ViewSource I>
+    void deserialize(std::span<const T> &value, I &ifs) {
+        static_assert(!(format_t<I>::varint && (VarintEncoded<T> || std::is_class_v<T>)),
+                      "varint-encoded integers cannot be viewed in place");
+        size_t size = readSize(ifs);
+        // a corrupt length must not wrap around once scaled to bytes; asking for more
+        // than the source holds makes it fail
+        size_t limit = SIZE_MAX / sizeof(T);
+        if constexpr (requires { ifs.remaining(); }) limit = ifs.remaining() / sizeof(T);
+        const std::byte *data = ifs.view(size > limit ? SIZE_MAX : size * sizeof(T), alignof(T));
+        if (data == nullptr) value = {};
+        else value = {reinterpret_cast<const T *>(data), size};
+    }
+
+    // std::list<T>
+    template<class T, class A, Sink O>
+    void serialize(const std::list<T, A> &value, O &ofs) {
+        size_t size = value.size();
+        writeSize(size, ofs);
+        serializeItems(value.begin(), size, ofs, [](const auto &item, auto &out) { serialize(item, out); });
+    }
+
+    template<class T, class A, Source I>
+    void deserialize(std::list<T, A> &value, I &ifs) {
+        size_t size = readLength(ifs);
+        if constexpr (format_t<I>::overwrite) {
+            // back to front, matching the order push_front gives on an empty list
+            value.resize(size);
+            for (auto item = value.rbegin(); item != value.rend(); item++) {
+                deserialize(*item, ifs);
+            }
+            return;
+        }
         for (int i = 0; i < size; i++) {
-            T item;
-            deserialize(item, ifs);
-            value.push_front(item);
+            deserialize(value.emplace_front(), ifs);
         }
     }
 
     // std::set<T>
-    template<class T>
-    void serialize(const std::set<T> &value, std::ofstream &ofs) {
+    template<class T, class C, class A, Sink O>
+    void serialize(const std::set<T, C, A> &value, O &ofs) {
         size_t size = value.size();
-        ofs.write(reinterpret_cast<const char *>(&size), sizeof(size));
-        for (auto item = value.begin(); item != value.end(); item++) {
-            serialize(*item, ofs);
+        writeSize(size, ofs);
+        if constexpr (format_t<O>::packed && PackedKey<T>) {
+            serializePackedKeys<T>(value.begin(), size, [](const T &key) { return key; }, ofs);
+            return;
         }
+        serializeItems(value.begin(), size, ofs, [](const auto &item, auto &out) { serialize(item, out); });
     }
 
-    template<class T>
-    void deserialize(std::set<T> &value, std::ifstream &ifs) {
-        size_t size;
-        ifs.read(reinterpret_cast<char *>(&size), sizeof(size));
+    // elements arrive in ascending order, so hinting at end() makes each insertion
+    // amortized O(1); out-of-order input still lands correctly, just without the speedup
+    template<class T, class C, class A, Source I>
+    void deserialize(std::set<T, C, A> &value, I &ifs) {
+        // a packed block of keys takes at least its first key and a width byte
+        size_t size = format_t<I>::packed && PackedKey<T> ? readLength(ifs, 2, bitpack::BLOCK) : readLength(ifs);
+        std::set<T, C, A> spare(value.key_comp(), value.get_allocator());
+        if constexpr (format_t<I>::overwrite) spare.swap(value);
+        if constexpr (format_t<I>::packed && PackedKey<T>) {
+            deserializePackedKeys<T>(size, ifs, [&](T key) {
+                if (auto node = spareNode(spare)) {
+                    node.value() = key;
+                    value.insert(value.end(), std::move(node));
+                } else {
+                    value.emplace_hint(value.end(), key);
+                }
+            });
+            return;
+        }
         for (int i = 0; i < size; i++) {
-            T item;
-            deserialize(item, ifs);
-            value.insert(item);
+            if (auto node = spareNode(spare)) {
+                deserialize(node.value(), ifs);
+                value.insert(value.end(), std::move(node));
+            } else {
+                T item = std::make_obj_using_allocator<T>(value.get_allocator());
+                deserialize(item, ifs);
+                value.emplace_hint(value.end(), std::move(item));
+            }
         }
     }
 
     // std::map<T1, T2>
-    template<class T1, class T2>
-    void serialize(const std::map<T1, T2> &value, std::ofstream &ofs) {
+    // with Packed and integral keys, all keys come first and then all values
+    template<class T1, class T2, class C, class A, Sink O>
+    void serialize(const std::map<T1, T2, C, A> &value, O &ofs) {
         size_t size = value.size();
-        ofs.write(reinterpret_cast<const char *>(&size), sizeof(size));
-        for (auto it = value.begin(); it != value.end(); it++) {
-            serialize(it->first, ofs);
-            serialize(it->second, ofs);
+        writeSize(size, ofs);
+        if constexpr (format_t<O>::packed && PackedKey<T1>) {
+            serializePackedKeys<T1>(value.begin(), size, [](const auto &entry) { return entry.first; }, ofs);
+            serializeItems(value.begin(), size, ofs, [](const auto &entry, auto &out) { serialize(entry.second, out); });
+            return;
         }
+        serializeItems(value.begin(), size, ofs, [](const auto &entry, auto &out) {
+            serialize(entry.first, out);
+            serialize(entry.second, out);
+        });
     }
 
-    template<class T1, class T2>
-    void deserialize(std::map<T1, T2> &value, std::ifstream &ifs) {
-        size_t size;
-        ifs.read(reinterpret_cast<char *>(&size), sizeof(size));
+    template<class T1, class T2, class C, class A, Source I>
+    void deserialize(std::map<T1, T2, C, A> &value, I &ifs) {
+        size_t size = format_t<I>::packed && PackedKey<T1> ? readLength(ifs, 2, bitpack::BLOCK) : readLength(ifs);
+        std::map<T1, T2, C, A> spare(value.key_comp(), value.get_allocator());
+        if constexpr (format_t<I>::overwrite) spare.swap(value);
+        if constexpr (format_t<I>::packed && PackedKey<T1>) {
+            std::vector<T1> keys;
+            keys.reserve(size);
+            deserializePackedKeys<T1>(size, ifs, [&](T1 key) { keys.push_back(key); });
+            for (size_t i = 0; i < keys.size(); i++) {
+                if (auto node = spareNode(spare)) {
+                    node.key() = keys[i];
+                    deserialize(node.mapped(), ifs);
+                    auto it = value.insert(value.end(), std::move(node));
+                    if (node) it->second = std::move(node.mapped());
+                } else {
+                    T2 t2 = std::make_obj_using_allocator<T2>(value.get_allocator());
+                    deserialize(t2, ifs);
+                    value.insert_or_assign(value.end(), keys[i], std::move(t2));
+                }
+            }
+            return;
+        }
         for (int i = 0; i < size; i++) {
-            T1 t1;
-            T2 t2;
-            deserialize(t1, ifs);
-            deserialize(t2, ifs);
-            value[t1] = t2;
+            if (auto node = spareNode(spare)) {
+                deserialize(node.key(), ifs);
+                deserialize(node.mapped(), ifs);
+                auto it = value.insert(value.end(), std::move(node));
+                if (node) it->second = std::move(node.mapped());
+            } else {
+                T1 t1 = std::make_obj_using_allocator<T1>(value.get_allocator());
+                T2 t2 = std::make_obj_using_allocator<T2>(value.get_allocator());
+                deserialize(t1, ifs);
+                deserialize(t2, ifs);
+                value.insert_or_assign(value.end(), std::move(t1), std::move(t2));
+            }
         }
     }
 
     // std::unique_ptr<T>
-    template<class T>
-    void serialize(const std::unique_ptr<T> &value, std::ofstream &ofs) {
+    template<class T, Sink O>
+    void serialize(const std::unique_ptr<T> &value, O &ofs) {
         serialize(*value.get(), ofs);
     }
 
-    template<class T>
-    void deserialize(std::unique_ptr<T> &value, std::ifstream &ifs) {
+    template<class T, Source I>
+    void deserialize(std::unique_ptr<T> &value, I &ifs) {
         deserialize(*value.get(), ifs);
     }
+
+    // user-defined types (GENERATE_SERIALIZATION)
+    template<class T, Sink O> requires SerializableTo<T, O>
+    void serialize(const T &value, O &ofs) {
+        value.serializeTo(ofs);
+    }
+
+    template<class T, Source I> requires DeserializableFrom<T, I>
+    void deserialize(T &value, I &ifs) {
+        value.deserializeFrom(ifs);
+    }
+
+    // moves past size bytes, without copying them where the source allows it
+    template <Source I>
+    void skipBytes(size_t size, I &ifs) {
+        if constexpr (ViewSource<I>) {
+            ifs.view(size);
+        } else if constexpr (requires { ifs.inner(); }) {
+            skipBytes(size, ifs.inner());
+        } else if constexpr (requires { ifs.seekg(std::streamoff(size), std::ios::cur); }) {
+            // a seek drops the stream's buffer, so short hops are read past instead
+            if (size < (1 << 16)) ifs.ignore(std::streamsize(size));
+            else ifs.seekg(std::streamoff(size), std::ios::cur);
+        } else {
+            char scratch[4096];
+            for (size_t n; size > 0; size -= n) {
+                n = std::min(size, sizeof(scratch));
+                ifs.read(scratch, n);
+            }
+        }
+    }
+
+    template <class T>
+    struct is_pair : std::false_type {};
+
+    template <class T1, class T2>
+    struct is_pair<std::pair<T1, T2>> : std::true_type {};
+
+    // the containers skip() steps through, each tagged with the element type it holds
+    template <class T>
+    struct is_vector : std::false_type {};
+
+    template <class T, class A>
+    struct is_vector<std::vector<T, A>> : std::true_type {};
+
+    template <class T>
+    struct is_vector<std::span<const T>> : std::true_type {};
+
+    template <class T>
+    struct is_list : std::false_type {};
+
+    template <class T, class A>
+    struct is_list<std::list<T, A>> : std::true_type {};
+
+    template <class T>
+    struct is_set : std::false_type {};
+
+    template <class T, class C, class A>
+    struct is_set<std::set<T, C, A>> : std::true_type {};
+
+    template <class T>
+    struct is_map : std::false_type {};
+
+    template <class T1, class T2, class C, class A>
+    struct is_map<std::map<T1, T2, C, A>> : std::true_type {};
+
+    template <class T>
+    struct is_unique_ptr : std::false_type {};
+
+    template <class T, class D>
+    struct is_unique_ptr<std::unique_ptr<T, D>> : std::true_type {};
+
+    template <class T, Source I> void skip(I &ifs);
+
+    // moves past one encoded GENERATE_SERIALIZATION class: packed ones are one block,
+    // tagged ones carry the length of every field, positional ones are walked field by
+    // field, each taken whole when the format frames it
+    template <class T, Source I>
+    void skipFields(I &ifs) {
+        using F = format_t<I>;
+        if constexpr (T::template serialization_packed<T>() && !F::varint && !F::framed) {
+            skipBytes(sizeof(T), ifs);
+        } else if constexpr (T::serialization_tagged()) {
+            for (uint64_t count = readVarint(ifs); count > 0; count--) {
+                readVarint(ifs);
+                skipBytes(readVarint(ifs), ifs);
+            }
+        } else {
+            using Fields = decltype(std::declval<T &>().serialization_fields());
+            [&]<size_t... K>(std::index_sequence<K...>) {
+                ([&] {
+                    if constexpr (F::framed) skipBytes(readSize(ifs), ifs);
+                    else skip<std::remove_cvref_t<std::tuple_element_t<K, Fields>>>(ifs);
+                }(), ...);
+            }(std::make_index_sequence<std::tuple_size_v<Fields>>());
+        }
+    }
+
+    // moves past one encoded T without building it: numbers, strings and block-copied
+    // vectors are skipped by length, containers element by element, pairs, pointees and
+    // user-defined classes by their parts. Only columnar vectors, whose rows are spread
+    // over columns, are decoded into a scratch value
+    template <class T, Source I>
+    void skip(I &ifs) {
+        using F = format_t<I>;
+        if constexpr (Arithmetic<T> && !(F::varint && VarintEncoded<T>)) {
+            skipBytes(sizeof(T), ifs);
+        } else if constexpr (Arithmetic<T>) {
+            readVarint(ifs);
+        } else if constexpr (is_string<T>::value || std::is_same_v<T, std::string_view>) {
+            skipBytes(readSize(ifs), ifs);
+        } else if constexpr (is_pair<T>::value) {
+            skip<typename T::first_type>(ifs);
+            skip<typename T::second_type>(ifs);
+        } else if constexpr (is_unique_ptr<T>::value) {
+            // the pointee is written without a null marker
+            skip<typename T::element_type>(ifs);
+        } else if constexpr (requires { T::serialization_tagged(); }) {
+            skipFields<T>(ifs);
+        } else if constexpr ((is_vector<T>::value && !(F::columnar && FieldAccessible<std::remove_cv_t<typename T::value_type>>)) ||
+                             is_list<T>::value) {
+            using E = std::remove_cv_t<typename T::value_type>;
+            size_t size = readSize(ifs);
+            if constexpr (is_vector<T>::value && blockCopied<E, F>) {
+                skipBytes(size * sizeof(E), ifs);
+            } else {
+                for (size_t i = 0; i < size; i++) skip<E>(ifs);
+            }
+        } else if constexpr (is_set<T>::value || is_map<T>::value) {
+            using K = typename T::key_type;
+            size_t size = readSize(ifs);
+            if constexpr (F::packed && PackedKey<K>) {
+                deserializePackedKeys<K>(size, ifs, [](K) {});
+                if constexpr (is_map<T>::value) {
+                    for (size_t i = 0; i < size; i++) skip<typename T::mapped_type>(ifs);
+                }
+            } else {
+                for (size_t i = 0; i < size; i++) {
+                    skip<K>(ifs);
+                    if constexpr (is_map<T>::value) skip<typename T::mapped_type>(ifs);
+                }
+            }
+        } else {
+            T scratch{};
+            deserialize(scratch, ifs);
+        }
+    }
+
+    // spare scratch buffers of serializeField, shared by every nesting depth on a thread
+    inline std::vector<std::unique_ptr<Buffer>> &fieldBuffers() {
+        thread_local std::vector<std::unique_ptr<Buffer>> buffers;
+        return buffers;
+    }
+
+    // one listed field of a GENERATE_SERIALIZATION class; framed formats prefix it with
+    // its encoded length so readers can step over it without looking inside. Fields of
+    // GENERATE_TAGGED_SERIALIZATION classes pass their tag and are always prefixed with
+    // the varint tag and varint length, whatever the format.
+    // Numbers, strings and block-copied vectors are measured directly. Anything else is
+    // encoded once into a scratch buffer and copied out: measuring it by encoding it would
+    // measure the fields of a nested framed class again at every level, exponential in
+    // the depth
+    template <class T, Sink O>
+    void serializeField(const T &value, O &ofs, size_t tag = 0) {
+        using F = format_t<O>;
+        if (tag == 0 && !F::framed) {
+            serialize(value, ofs);
+            return;
+        }
+        auto prefix = [&](size_t size) {
+            if (tag != 0) {
+                writeVarint(tag, ofs);
+                writeVarint(size, ofs);
+            } else {
+                writeSize(size, ofs);
+            }
+        };
+        constexpr bool measured = [] {
+            if constexpr (is_vector<T>::value) {
+                using E = std::remove_cv_t<typename T::value_type>;
+                return blockCopied<E, F> && !(F::columnar && FieldAccessible<E>);
+            } else {
+                return Arithmetic<T> || is_string<T>::value;
+            }
+        }();
+        if constexpr (measured) {
+            SizeCounter counter;
+            Formatted<SizeCounter, F> sized(counter);
+            serialize(value, sized);
+            prefix(counter.size());
+            serialize(value, ofs);
+        } else {
+            auto &buffers = fieldBuffers();
+            std::unique_ptr<Buffer> field;
+            if (buffers.empty()) {
+                field = std::make_unique<Buffer>();
+            } else {
+                field = std::move(buffers.back());
+                buffers.pop_back();
+            }
+            field->clear();
+            Formatted<Buffer, F> out(*field);
+            serialize(value, out);
+            prefix(field->size());
+            ofs.write(reinterpret_cast<const char *>(field->data()), field->size());
+            // a huge field's capacity is not worth keeping around
+            if (field->size() <= (1 << 20)) buffers.push_back(std::move(field));
+        }
+    }
+
+    // fields that are not selected are skipped instead of decoded
+    template <class T, Source I>
+    void deserializeField(T &value, I &ifs, bool selected = true) {
+        if constexpr (format_t<I>::framed) {
+            size_t size = readSize(ifs);
+            if (!selected) {
+                skipBytes(size, ifs);
+                return;
+            }
+        } else if (!selected) {
+            skip<T>(ifs);
+            return;
+        }
+        deserialize(value, ifs);
+    }
+
+    // number of bytes serialize(value, ...) will produce
+    template<class F = Fixed, class T>
+    size_t serializedSize(const T &value) {
+        SizeCounter counter;
+        Formatted<SizeCounter, F> out(counter);
+        serialize(value, out);
+        return counter.size();
+    }
+
+    // decode into a freshly built T whose allocator-aware parts (std::pmr containers and
+    // strings, at any depth) all allocate from resource, e.g. one monotonic arena that
+    // can be released in O(1); uses the source's own format
+    template<class T, Source I>
+    T decode(I &ifs, std::pmr::memory_resource *resource) {
+        T value = std::make_obj_using_allocator<T>(std::pmr::polymorphic_allocator<>(resource));
+        deserialize(value, ifs);
+        return value;
+    }
+
     // binarySerialize && binaryDeserialize
-    template<class T>
+    // F picks the wire format, e.g. binarySerialize<binary::Compact>(value, filename)
+    template<class F = Fixed, class T>
     void binarySerialize(const T &value, std::string &filename) {
         std::ofstream ofs(filename, std::ios::binary);
         if (!ofs) {
             std::cerr << "Error opening file when serilization." << std::endl;
             return;
         }
-        serialize(value, ofs);
+        Formatted<std::ofstream, F> out(ofs);
+        serialize(value, out);
         ofs.close();
     }
 
-    template<class T>
+    // same file layout, written through a raw-fd FdSink instead of std::ofstream
+    template<class F = Fixed, class T>
+    void binarySerialize(const T &value, std::string &filename, const FdOptions &options) {
+        FdSink sink(filename, options);
+        if (!sink) {
+            std::cerr << "Error opening file when serilization." << std::endl;
+            return;
+        }
+        Formatted<FdSink, F> out(sink);
+        serialize(value, out);
+        if (!sink.close()) {
+            std::cerr << "Error writing file when serilization." << std::endl;
+        }
+    }
+
+    template<class F = Fixed, class T>
     void binaryDeserialize(T &value, std::string &filename) {
         std::ifstream ifs(filename, std::ios::binary);
         if (!ifs) {
             std::cerr << "Error opening file when deserilization." << std::endl;
             return;
         }
-        deserialize(value, ifs);
+        Formatted<std::ifstream, F> in(ifs);
+        deserialize(value, in);
         ifs.close();
     }
 
+    template<class T, class F = Fixed>
+    T binaryDecode(std::string &filename, std::pmr::memory_resource *resource) {
+        std::ifstream ifs(filename, std::ios::binary);
+        if (!ifs) {
+            std::cerr << "Error opening file when deserilization." << std::endl;
+            return std::make_obj_using_allocator<T>(std::pmr::polymorphic_allocator<>(resource));
+        }
+        Formatted<std::ifstream, F> in(ifs);
+        return decode<T>(in, resource);
+    }
+
+    // decodes from a read-only mapping of the file instead of std::ifstream
+    template<class F = Fixed, class T>
+    void binaryDeserialize(T &value, std::string &filename, const MmapOptions &options) {
+        MappedFile file(filename, options);
+        if (!file) {
+            std::cerr << "Error opening file when deserilization." << std::endl;
+            return;
+        }
+        BufferReader reader(file.bytes());
+        Formatted<BufferReader, F> in(reader);
+        deserialize(value, in);
+    }
+
+    // bufferSerialize && bufferDeserialize
+    // appends the encoding of value to buffer, growing it at most once
+    template<class F = Fixed, class T>
+    void bufferSerialize(const T &value, Buffer &buffer) {
+        buffer.reserve(buffer.size() + serializedSize<F>(value));
+        Formatted<Buffer, F> out(buffer);
+        serialize(value, out);
+    }
+
+    // returns false if bytes ended before value was fully decoded, or hold a length
+    // prefix larger than what is left of them
+    template<class F = Fixed, class T>
+    bool bufferDeserialize(T &value, std::span<const std::byte> bytes) {
+        BufferReader reader(bytes);
+        Formatted<BufferReader, F> in(reader);
+        deserialize(value, in);
+        return !reader.fail();
+    }
+
 }
 
 #endif // !SERIALIZE_BINARY_H
-
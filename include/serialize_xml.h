@@ -38,8 +38,9 @@ namespace xml {
     template <class T>
     void xmlSerialize(T &value, std::string filename, bool base64 = false);
 
+    // overwrite replaces container contents instead of appending, reusing their storage
     template <class T>
-    void xmlDeserialize(T &value, std::string filename, bool base64 = false);
+    void xmlDeserialize(T &value, std::string filename, bool base64 = false, bool overwrite = false);
 
     // std::is_arithmetic
     template <Arithmetic T>
@@ -54,7 +55,7 @@ namespace xml {
     }
 
     template <Arithmetic T>
-    void deserialize(T &value, tinyxml2::XMLElement *element, bool base64) {
+    void deserialize(T &value, tinyxml2::XMLElement *element, bool base64, bool overwrite = false) {
         if (base64) {
             std::string str(element->GetText());
             str = base64::decode(str);
@@ -66,19 +67,39 @@ namespace xml {
     }
 
     // std::string
-    inline tinyxml2::XMLElement *serialize(const std::string &value, tinyxml2::XMLDocument &doc, bool base64) {
+    template<class Tr, class A>
+    tinyxml2::XMLElement *serialize(const std::basic_string<char, Tr, A> &value, tinyxml2::XMLDocument &doc, bool base64) {
         tinyxml2::XMLElement *element = doc.NewElement("std_string");
         if (base64) {
-            element->SetText(base64::encode(value).c_str());
+            element->SetText(base64::encode(std::string(value.data(), value.size())).c_str());
         } else {
             element->SetText(value.c_str());
         }
         return element;
     }
 
-    inline void deserialize(std::string &value, tinyxml2::XMLElement *element, bool base64) {
-        if (base64) value = base64::decode(element->GetText());
-        else value = element->GetText();
+    template<class Tr, class A>
+    void deserialize(std::basic_string<char, Tr, A> &value, tinyxml2::XMLElement *element, bool base64, bool overwrite = false) {
+        if (base64) {
+            std::string decoded = base64::decode(element->GetText());
+            value.assign(decoded.data(), decoded.size());
+        } else {
+            value = element->GetText();
+        }
+    }
+
+    // user-defined types (GENERATE_SERIALIZATION), e.g. inside containers
+    template <class T>
+    concept Nested = requires(const T &value, tinyxml2::XMLDocument &doc) { value.xmlSerializeTo(doc); };
+
+    template <Nested T>
+    tinyxml2::XMLElement *serialize(const T &value, tinyxml2::XMLDocument &doc, bool base64) {
+        return value.xmlSerializeTo(doc);
+    }
+
+    template <Nested T>
+    void deserialize(T &value, tinyxml2::XMLElement *element, bool base64, bool overwrite = false) {
+        value.xmlDeserializeFrom(element, overwrite);
     }
 
     // std::pair
@@ -98,14 +119,14 @@ namespace xml {
     }
 
     template<class T1, class T2>
-    void deserialize(std::pair<T1, T2> &value, tinyxml2::XMLElement *element, bool base64) {
-        deserialize(value.first, element->FirstChildElement("first")->FirstChildElement(), base64);
-        deserialize(value.second, element->FirstChildElement("second")->FirstChildElement(), base64);
+    void deserialize(std::pair<T1, T2> &value, tinyxml2::XMLElement *element, bool base64, bool overwrite = false) {
+        deserialize(value.first, element->FirstChildElement("first")->FirstChildElement(), base64, overwrite);
+        deserialize(value.second, element->FirstChildElement("second")->FirstChildElement(), base64, overwrite);
     }
 
     // std::vector
-    template<class T>
-    tinyxml2::XMLElement *serialize(const std::vector<T> &value, tinyxml2::XMLDocument &doc, bool base64) {
+    template<class T, class A>
+    tinyxml2::XMLElement *serialize(const std::vector<T, A> &value, tinyxml2::XMLDocument &doc, bool base64) {
         tinyxml2::XMLElement *element = doc.NewElement("std_vector");
         size_t _size = value.size();
         tinyxml2::XMLElement *size = element->InsertNewChildElement("size_t");
@@ -116,22 +137,42 @@ namespace xml {
         return element;
     }
 
-    template<class T>
-    void deserialize(std::vector<T> &value, tinyxml2::XMLElement *element, bool base64) {
+    template<class T, class A>
+    void deserialize(std::vector<T, A> &value, tinyxml2::XMLElement *element, bool base64, bool overwrite = false) {
         int size;
         tinyxml2::XMLElement *it = element->FirstChildElement();
         deserialize(size, it, false);
+        if (overwrite) {
+            value.resize(size);
+            for (int i = 0; i < size; i++) {
+                it = it->NextSiblingElement();
+                if constexpr (std::is_same_v<T, bool>) {
+                    bool item;
+                    deserialize(item, it, base64, true);
+                    value[i] = item;
+                } else {
+                    deserialize(value[i], it, base64, true);
+                }
+            }
+            return;
+        }
+        value.reserve(value.size() + size);
         for (int i = 0; i < size; i++) {
-            T item;
             it = it->NextSiblingElement();
-            deserialize(item, it, base64);
-            value.push_back(item);
+            if constexpr (std::is_same_v<T, bool>) {
+                // std::vector<bool> hands out proxies, which cannot be decoded into
+                bool item;
+                deserialize(item, it, base64);
+                value.push_back(item);
+            } else {
+                deserialize(value.emplace_back(), it, base64);
+            }
         }
     }
 
     // std::list
-    template<class T>
-    tinyxml2::XMLElement *serialize(const std::list<T> &value, tinyxml2::XMLDocument &doc, bool base64) {
+    template<class T, class A>
+    tinyxml2::XMLElement *serialize(const std::list<T, A> &value, tinyxml2::XMLDocument &doc, bool base64) {
         tinyxml2::XMLElement *element = doc.NewElement("std_list");
         size_t _size = value.size();
         tinyxml2::XMLElement *size = element->InsertNewChildElement("size_t");
@@ -142,22 +183,28 @@ namespace xml {
         return element;
     }
 
-    template<class T>
-    void deserialize(std::list<T> &value, tinyxml2::XMLElement *element, bool base64) {
+    template<class T, class A>
+    void deserialize(std::list<T, A> &value, tinyxml2::XMLElement *element, bool base64, bool overwrite = false) {
         int size;
         tinyxml2::XMLElement *it = element->FirstChildElement();
         deserialize(size, it, false);
+        if (overwrite) {
+            value.resize(size);
+            for (auto item = value.begin(); item != value.end(); item++) {
+                it = it->NextSiblingElement();
+                deserialize(*item, it, base64, true);
+            }
+            return;
+        }
         for (int i = 0; i < size; i++) {
-            T item;
             it = it->NextSiblingElement();
-            deserialize(item, it, base64);
-            value.push_back(item);
+            deserialize(value.emplace_back(), it, base64);
         }
     }
 
     // std::set
-    template<class T>
-    tinyxml2::XMLElement *serialize(const std::set<T> &value, tinyxml2::XMLDocument &doc, bool base64) {
+    template<class T, class C, class A>
+    tinyxml2::XMLElement *serialize(const std::set<T, C, A> &value, tinyxml2::XMLDocument &doc, bool base64) {
         tinyxml2::XMLElement *element = doc.NewElement("std_set");
         size_t _size = value.size();
         tinyxml2::XMLElement *size = element->InsertNewChildElement("size_t");
@@ -168,22 +215,30 @@ namespace xml {
         return element;
     }
 
-    template<class T>
-    void deserialize(std::set<T> &value, tinyxml2::XMLElement *element, bool base64) {
+    template<class T, class C, class A>
+    void deserialize(std::set<T, C, A> &value, tinyxml2::XMLElement *element, bool base64, bool overwrite = false) {
         int size;
         tinyxml2::XMLElement *it = element->FirstChildElement();
         deserialize(size, it, false);
+        std::set<T, C, A> spare(value.key_comp(), value.get_allocator());
+        if (overwrite) spare.swap(value);
         for (int i = 0; i < size; i++) {
-            T item;
             it = it->NextSiblingElement();
-            deserialize(item, it, base64);
-            value.insert(item);
+            if (!spare.empty()) {
+                auto node = spare.extract(spare.begin());
+                deserialize(node.value(), it, base64, true);
+                value.insert(value.end(), std::move(node));
+            } else {
+                T item = std::make_obj_using_allocator<T>(value.get_allocator());
+                deserialize(item, it, base64, overwrite);
+                value.emplace_hint(value.end(), std::move(item));
+            }
         }
     }
 
     // std::map
-    template<class T1, class T2>
-    tinyxml2::XMLElement *serialize(const std::map<T1, T2> &value, tinyxml2::XMLDocument &doc, bool base64) {
+    template<class T1, class T2, class C, class A>
+    tinyxml2::XMLElement *serialize(const std::map<T1, T2, C, A> &value, tinyxml2::XMLDocument &doc, bool base64) {
         tinyxml2::XMLElement *element = doc.NewElement("std_map");
         size_t _size = value.size();
         tinyxml2::XMLElement *size = element->InsertNewChildElement("size_t");
@@ -197,18 +252,28 @@ namespace xml {
         return element;
     }
 
-    template<class T1, class T2>
-    void deserialize(std::map<T1, T2> &value, tinyxml2::XMLElement *element, bool base64) {
+    template<class T1, class T2, class C, class A>
+    void deserialize(std::map<T1, T2, C, A> &value, tinyxml2::XMLElement *element, bool base64, bool overwrite = false) {
         int size;
         tinyxml2::XMLElement *it = element->FirstChildElement();
         deserialize(size, it, false);
+        std::map<T1, T2, C, A> spare(value.key_comp(), value.get_allocator());
+        if (overwrite) spare.swap(value);
         for (int i = 0; i < size; i++) {
-            T1 k;
-            T2 v;
             it = it->NextSiblingElement();
-            deserialize(k, it->FirstChildElement(), base64);
-            deserialize(v, it->LastChildElement(), base64);
-            value[k] = v;
+            if (!spare.empty()) {
+                auto node = spare.extract(spare.begin());
+                deserialize(node.key(), it->FirstChildElement(), base64, true);
+                deserialize(node.mapped(), it->LastChildElement(), base64, true);
+                auto entry = value.insert(value.end(), std::move(node));
+                if (node) entry->second = std::move(node.mapped());
+            } else {
+                T1 k = std::make_obj_using_allocator<T1>(value.get_allocator());
+                T2 v = std::make_obj_using_allocator<T2>(value.get_allocator());
+                deserialize(k, it->FirstChildElement(), base64, overwrite);
+                deserialize(v, it->LastChildElement(), base64, overwrite);
+                value.insert_or_assign(value.end(), std::move(k), std::move(v));
+            }
         }
     }
 
@@ -221,8 +286,8 @@ namespace xml {
     }
 
     template<class T>
-    void deserialize(std::unique_ptr<T> &value, tinyxml2::XMLElement *element, bool base64) {
-        deserialize(*value.get(), element->FirstChildElement(), base64);
+    void deserialize(std::unique_ptr<T> &value, tinyxml2::XMLElement *element, bool base64, bool overwrite = false) {
+        deserialize(*value.get(), element->FirstChildElement(), base64, overwrite);
     }
 
     // xmlSerialize && xmlDeserialize
@@ -238,13 +303,13 @@ namespace xml {
     }
 
     template<class T>
-    void xmlDeserialize(T &value, std::string filename, bool base64) {
+    void xmlDeserialize(T &value, std::string filename, bool base64, bool overwrite) {
         tinyxml2::XMLDocument doc;
         doc.LoadFile(filename.c_str());
         // doc.Print();
         tinyxml2::XMLElement *element = doc.FirstChildElement()->FirstChildElement();
 
-        deserialize(value, element, base64);
+        deserialize(value, element, base64, overwrite);
     }
 }
 
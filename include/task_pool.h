@@ -0,0 +1,65 @@
+#ifndef TASK_POOL_H
+#define TASK_POOL_H
+
+#include <algorithm>
+#include <atomic>
+#include <condition_variable>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+namespace binary {
+    // work-stealing pool: each thread pushes the tasks it spawns onto its own deque and
+    // runs them newest first, while idle threads steal the oldest task of another one.
+    // A thread that keeps finding nothing to run sleeps until a task is spawned or the run
+    // ends
+    class TaskPool {
+    public:
+        explicit TaskPool(size_t threads = std::max(1u, std::thread::hardware_concurrency()));
+        ~TaskPool();
+        TaskPool(const TaskPool &) = delete;
+        TaskPool &operator=(const TaskPool &) = delete;
+
+        size_t size() const { return workers_.size(); }
+
+        // runs root on the calling thread, which then works alongside the pool until every
+        // task spawned from it has finished; one run at a time
+        void run(const std::function<void()> &root);
+
+        // from inside run() only
+        void spawn(std::function<void()> task);
+
+        // true when the calling thread has nothing queued, so a thread going idle would
+        // find nothing to steal from it; the cue to split work
+        bool hungry() const;
+
+    private:
+        struct Worker {
+            std::mutex mutex;
+            std::deque<std::function<void()>> tasks;
+            std::atomic<size_t> queued{0};
+        };
+
+        bool runOne(size_t self);
+        void loop(size_t self);
+        void idle(uint32_t seen, size_t &misses);
+        void signal(bool all);
+
+        std::vector<std::unique_ptr<Worker>> workers_;  // 0 belongs to the thread in run()
+        std::vector<std::thread> threads_;
+        std::atomic<size_t> pending_{0};
+        std::atomic<bool> active_{false};
+        std::atomic<uint32_t> signal_{0};               // bumped on every spawn and when pending_ drains
+        std::atomic<uint32_t> sleepers_{0};             // threads waiting on signal_
+        std::mutex mutex_;
+        std::condition_variable wake_;
+        bool stop_ = false;
+    };
+}
+
+#endif // !TASK_POOL_H
@@ -0,0 +1,329 @@
+#ifndef ZONE_MAP_H
+#define ZONE_MAP_H
+
+#include "binary_io.h"
+#include "parallel.h"
+#include "serialize_binary.h"
+#include <algorithm>
+#include <cmath>
+#include <cstdint>
+#include <cstring>
+#include <iostream>
+#include <limits>
+#include <memory>
+#include <span>
+#include <string>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
+
+// std::vector of a GENERATE_SERIALIZATION class split into chunks of a fixed number of
+// rows, each stored column by column, with the min and max of every numeric field per
+// chunk so scans can skip chunks a filter rules out:
+//   ZONE_MAGIC, element count, rows per chunk, chunk count, field count, u64 each
+//   for every chunk and field: column byte size, min, max, u64 each; min and max hold the
+//     field's own bytes and are only set for numeric fields of at most 8 bytes
+//   the chunks, each its columns back to back, encoded as the columnar format does
+namespace binary {
+    constexpr uint64_t ZONE_MAGIC = 0x31454E4F5A534942;  // "BISZONE1"
+    constexpr size_t ZONE_HEADER = 5 * sizeof(uint64_t);
+
+    template <class T>
+    using fields_t = decltype(std::declval<const T &>().serialization_fields());
+
+    template <class T, size_t K>
+    using field_t = std::remove_cvref_t<std::tuple_element_t<K, fields_t<T>>>;
+
+    // numeric fields whose min and max fit a directory slot; long double has no statistics
+    template <class M>
+    concept ZoneStatistic = Arithmetic<M> && sizeof(M) <= sizeof(uint64_t);
+
+    // rows whose field lies in [min, max]; NaNs never match
+    template <class T, class M>
+    struct FieldRange {
+        M T::*field;
+        M min;
+        M max;
+
+        bool operator()(const M &value) const { return !(value < min) && !(max < value) && value == value; }
+    };
+
+    template <class T, class M>
+    FieldRange<T, M> between(M T::*field, std::type_identity_t<M> min, std::type_identity_t<M> max) {
+        return {field, min, max};
+    }
+
+    template <class T, class M>
+    FieldRange<T, M> atLeast(M T::*field, std::type_identity_t<M> min) {
+        if constexpr (std::numeric_limits<M>::has_infinity) return {field, min, std::numeric_limits<M>::infinity()};
+        else return {field, min, std::numeric_limits<M>::max()};
+    }
+
+    template <class T, class M>
+    FieldRange<T, M> atMost(M T::*field, std::type_identity_t<M> max) {
+        if constexpr (std::numeric_limits<M>::has_infinity) return {field, -std::numeric_limits<M>::infinity(), max};
+        else return {field, std::numeric_limits<M>::lowest(), max};
+    }
+
+    template <class T, class M>
+    FieldRange<T, M> equalTo(M T::*field, std::type_identity_t<M> value) {
+        return {field, value, value};
+    }
+
+    struct ScanStats {
+        size_t chunks = 0;         // chunks in the file
+        size_t skippedChunks = 0;  // ruled out by their min and max alone
+        size_t rows = 0;           // rows whose filter field was decoded
+        size_t matched = 0;        // rows materialized and visited
+        bool failed = false;       // a damaged file or a field not listed; the scan stopped early
+    };
+
+    // one column of a chunk, and its min and max when the field is numeric
+    template <class F, size_t K, class T>
+    void serializeZoneColumn(std::span<const T> rows, Buffer &chunk, uint64_t *entry) {
+        using M = field_t<T, K>;
+        Formatted<Buffer, F> out(chunk);
+        size_t start = chunk.size();
+        serializeColumn<M>(rows, [](const T &row) -> const auto & { return std::get<K>(row.serialization_fields()); }, out);
+        entry[0] = chunk.size() - start;
+        if constexpr (ZoneStatistic<M>) {
+            // NaNs are left out; a chunk of nothing else keeps min above max and is never scanned
+            M min = std::numeric_limits<M>::max(), max = std::numeric_limits<M>::lowest();
+            if constexpr (std::numeric_limits<M>::has_infinity) {
+                min = std::numeric_limits<M>::infinity();
+                max = -std::numeric_limits<M>::infinity();
+            }
+            for (const T &row : rows) {
+                M value = std::get<K>(row.serialization_fields());
+                if (value != value) continue;
+                min = std::min(min, value);
+                max = std::max(max, value);
+            }
+            std::memcpy(&entry[1], &min, sizeof(M));
+            std::memcpy(&entry[2], &max, sizeof(M));
+        }
+    }
+
+    template <class F = Fixed, class T, class A, Sink O>
+    void serializeZoned(const std::vector<T, A> &value, O &ofs, const ParallelOptions &options = {}) {
+        static_assert(FieldAccessible<T>, "zone maps need a GENERATE_SERIALIZATION class");
+        constexpr size_t fields = std::tuple_size_v<fields_t<T>>;
+        size_t chunkSize = std::max<size_t>(1, options.chunkSize);
+        size_t count = (value.size() + chunkSize - 1) / chunkSize;
+        std::vector<uint64_t> header = {ZONE_MAGIC, value.size(), chunkSize, count, fields};
+        std::vector<uint64_t> directory(count * fields * 3, 0);
+        std::vector<Buffer> chunks(count);
+        parallelFor(count, options.threads, [&](size_t c) {
+            std::span<const T> rows(value.data() + c * chunkSize, std::min(chunkSize, value.size() - c * chunkSize));
+            [&]<size_t... K>(std::index_sequence<K...>) {
+                (serializeZoneColumn<F, K>(rows, chunks[c], &directory[(c * fields + K) * 3]), ...);
+            }(std::make_index_sequence<fields>());
+        });
+        ofs.write(reinterpret_cast<const char *>(header.data()), header.size() * sizeof(uint64_t));
+        ofs.write(reinterpret_cast<const char *>(directory.data()), directory.size() * sizeof(uint64_t));
+        for (const auto &chunk : chunks) ofs.write(reinterpret_cast<const char *>(chunk.data()), chunk.size());
+    }
+
+    template <class F = Fixed, class T, class A>
+    void binarySerializeZoned(const std::vector<T, A> &value, const std::string &filename, const ParallelOptions &options = {}) {
+        FdSink sink(filename);
+        if (!sink) {
+            std::cerr << "Error opening file when serilization." << std::endl;
+            return;
+        }
+        serializeZoned<F>(value, sink, options);
+        if (!sink.close()) {
+            std::cerr << "Error writing file when serilization." << std::endl;
+        }
+    }
+
+    // filtered scans of a zoned file: chunks whose min and max rule the range out are
+    // skipped unread, the filter column of the others is decoded first, and only the rows
+    // it keeps are materialized from the remaining columns
+    template <class T, class F = Fixed>
+    class ZonedReader {
+    public:
+        explicit ZonedReader(const std::string &filename)
+            : file_(std::make_unique<MappedFile>(filename)) {
+            if (file_->fail()) {
+                std::cerr << "Error opening file when deserilization." << std::endl;
+                fail_ = true;
+                return;
+            }
+            open(file_->bytes());
+        }
+
+        // borrows bytes, e.g. a Buffer filled by serializeZoned
+        explicit ZonedReader(std::span<const std::byte> bytes) { open(bytes); }
+
+        bool fail() const { return fail_; }
+        explicit operator bool() const { return !fail_; }
+        size_t size() const { return size_; }
+        size_t chunks() const { return chunks_; }
+
+        // calls visit(const T &) for every row in range, in file order; the row is reused
+        // afterwards
+        template <class M, class Visit>
+        ScanStats scan(const FieldRange<T, M> &range, Visit visit) const {
+            ScanStats stats;
+            stats.chunks = chunks_;
+            size_t field = fieldIndex(range.field);
+            if (fail_ || field == FIELDS) {
+                stats.failed = true;
+                return stats;
+            }
+            [&]<size_t... K>(std::index_sequence<K...>) {
+                ([&] {
+                    if constexpr (std::is_same_v<M, field_t<T, K>>) {
+                        if (K == field) scanBy<K>(range, visit, stats);
+                    }
+                }(), ...);
+            }(std::make_index_sequence<FIELDS>());
+            return stats;
+        }
+
+    private:
+        static constexpr size_t FIELDS = std::tuple_size_v<fields_t<T>>;
+        static constexpr uint32_t UNSELECTED = UINT32_MAX;
+
+        // rows of one chunk as deserializeColumn sees them: selected rows are slots of the
+        // output, every other row is the same scratch row, overwritten and thrown away
+        struct Selection {
+            T *matched;
+            T *scratch;
+            const uint32_t *slots;
+            size_t rows;
+
+            size_t size() const { return rows; }
+            T &operator[](size_t i) { return slots[i] == UNSELECTED ? *scratch : matched[slots[i]]; }
+        };
+
+        // the position of field among the listed fields
+        template <class M>
+        static size_t fieldIndex(M T::*field) {
+            T probe{};
+            const void *address = &(probe.*field);
+            size_t index = FIELDS;
+            [&]<size_t... K>(std::index_sequence<K...>) {
+                ((static_cast<const void *>(&std::get<K>(probe.serialization_fields())) == address ? (index = K) : 0), ...);
+            }(std::make_index_sequence<FIELDS>());
+            return index;
+        }
+
+        template <size_t K, class M, class Visit>
+        void scanBy(const FieldRange<T, M> &range, Visit &visit, ScanStats &stats) const {
+            using In = Formatted<BufferReader, Overwrite<F>>;
+            std::vector<T> matched;
+            std::vector<M> column;
+            std::vector<uint32_t> slots;
+            T scratch{};
+            for (size_t c = 0; c < chunks_; c++) {
+                const uint64_t *entry = &directory_[c * FIELDS * 3];
+                if constexpr (ZoneStatistic<M>) {
+                    M min, max;
+                    std::memcpy(&min, &entry[K * 3 + 1], sizeof(M));
+                    std::memcpy(&max, &entry[K * 3 + 2], sizeof(M));
+                    if (max < min || max < range.min || range.max < min) {
+                        stats.skippedChunks++;
+                        continue;
+                    }
+                }
+                size_t rows = std::min<size_t>(chunkSize_, size_ - c * chunkSize_);
+                stats.rows += rows;
+
+                column.resize(rows);
+                BufferReader filter(columnBytes(c, K));
+                In filterIn(filter);
+                deserializeColumn<M>(column, 0, [](M &value) -> M & { return value; }, filterIn);
+                if (filter.fail()) {
+                    std::cerr << "Error reading file when deserilization." << std::endl;
+                    stats.failed = true;
+                    return;
+                }
+                slots.assign(rows, UNSELECTED);
+                size_t selected = 0;
+                for (size_t i = 0; i < rows; i++) {
+                    if (range(column[i])) slots[i] = static_cast<uint32_t>(selected++);
+                }
+                if (selected == 0) continue;
+
+                if (matched.size() < selected) matched.resize(selected);
+                Selection selection{matched.data(), &scratch, slots.data(), rows};
+                bool ok = true;
+                [&]<size_t... J>(std::index_sequence<J...>) {
+                    ((J == K ? 0 : (ok = ok && readColumn<J>(selection, columnBytes(c, J)), 0)), ...);
+                }(std::make_index_sequence<FIELDS>());
+                if (!ok) {
+                    std::cerr << "Error reading file when deserilization." << std::endl;
+                    stats.failed = true;
+                    return;
+                }
+                for (size_t i = 0; i < rows; i++) {
+                    if (slots[i] != UNSELECTED) std::get<K>(matched[slots[i]].serialization_fields()) = column[i];
+                }
+                for (size_t i = 0; i < selected; i++) visit(static_cast<const T &>(matched[i]));
+                stats.matched += selected;
+            }
+        }
+
+        template <size_t J>
+        static bool readColumn(Selection &selection, std::span<const std::byte> bytes) {
+            BufferReader reader(bytes);
+            Formatted<BufferReader, Overwrite<F>> in(reader);
+            deserializeColumn<field_t<T, J>>(selection, 0, [](T &row) -> auto & { return std::get<J>(row.serialization_fields()); }, in);
+            return !reader.fail();
+        }
+
+        std::span<const std::byte> columnBytes(size_t chunk, size_t field) const {
+            return bytes_.subspan(columns_[chunk * FIELDS + field], directory_[(chunk * FIELDS + field) * 3]);
+        }
+
+        void open(std::span<const std::byte> bytes) {
+            uint64_t header[5];
+            if (bytes.size() < ZONE_HEADER) {
+                fail_ = true;
+                return;
+            }
+            std::memcpy(header, bytes.data(), ZONE_HEADER);
+            // the chunk count is checked against the file before it is multiplied
+            if (header[0] != ZONE_MAGIC || header[4] != FIELDS || header[2] == 0 ||
+                header[3] != header[1] / header[2] + (header[1] % header[2] != 0) ||
+                header[3] > (bytes.size() - ZONE_HEADER) / sizeof(uint64_t) / std::max<size_t>(FIELDS * 3, 1)) {
+                std::cerr << "Error reading index when deserilization." << std::endl;
+                fail_ = true;
+                return;
+            }
+            size_t entries = header[3] * FIELDS * 3;
+            size_ = header[1];
+            chunkSize_ = header[2];
+            directory_.resize(entries);
+            std::memcpy(directory_.data(), bytes.data() + ZONE_HEADER, entries * sizeof(uint64_t));
+            chunks_ = header[3];
+            columns_.resize(header[3] * FIELDS);
+            size_t offset = ZONE_HEADER + entries * sizeof(uint64_t);
+            for (size_t i = 0; i < columns_.size(); i++) {
+                uint64_t size = directory_[i * 3];
+                if (size > bytes.size() - offset) {
+                    std::cerr << "Error reading index when deserilization." << std::endl;
+                    fail_ = true;
+                    return;
+                }
+                columns_[i] = offset;
+                offset += size;
+            }
+            bytes_ = bytes;
+        }
+
+        std::unique_ptr<MappedFile> file_;
+        std::span<const std::byte> bytes_;
+        std::vector<uint64_t> directory_;
+        std::vector<size_t> columns_;  // start of every chunk's every column
+        size_t size_ = 0;
+        size_t chunks_ = 0;
+        size_t chunkSize_ = 1;
+        bool fail_ = false;
+    };
+}
+
+#endif // !ZONE_MAP_H
@@ -0,0 +1,203 @@
+#include "binary_io.h"
+
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <sys/uio.h>
+#include <unistd.h>
+
+binary::FdSink::FdSink(const std::string &filename, FdOptions options)
+    : options_(options), buffer_(new char[options.bufferSize]) {
+    fd_ = ::open(filename.c_str(), O_WRONLY | O_CREAT | O_TRUNC | O_CLOEXEC, 0644);
+    fail_ = fd_ < 0;
+}
+
+binary::FdSink::~FdSink() {
+    close();
+}
+
+void binary::FdSink::write(const char *data, std::streamsize size) {
+    if (fail_) return;
+    if (static_cast<size_t>(size) >= options_.passthrough || static_cast<size_t>(size) > options_.bufferSize) {
+        writeAll(data, size);
+        return;
+    }
+    if (used_ + size > options_.bufferSize && !flush()) return;
+    std::memcpy(buffer_.get() + used_, data, size);
+    used_ += size;
+}
+
+bool binary::FdSink::flush() {
+    return writeAll(nullptr, 0);
+}
+
+bool binary::FdSink::sync() {
+    if (fd_ < 0 || !flush()) return false;
+    if (::fdatasync(fd_) != 0) fail_ = true;
+    return !fail_;
+}
+
+bool binary::FdSink::close() {
+    if (fd_ < 0) return !fail_;
+    flush();
+    if (::close(fd_) != 0) fail_ = true;
+    fd_ = -1;
+    return !fail_;
+}
+
+// writes the pending buffer followed by data[0, size) with as few syscalls as possible
+bool binary::FdSink::writeAll(const char *data, size_t size) {
+    if (fail_) return false;
+    iovec iov[2] = {{buffer_.get(), used_}, {const_cast<char *>(data), size}};
+    iovec *cur = iov;
+    int count = size > 0 ? 2 : 1;
+    while (count > 0) {
+        if (cur->iov_len == 0) {
+            cur++;
+            count--;
+            continue;
+        }
+        ssize_t written = ::writev(fd_, cur, count);
+        if (written < 0) {
+            if (errno == EINTR) continue;
+            fail_ = true;
+            return false;
+        }
+        while (count > 0 && static_cast<size_t>(written) >= cur->iov_len) {
+            written -= cur->iov_len;
+            cur++;
+            count--;
+        }
+        if (count > 0) {
+            cur->iov_base = static_cast<char *>(cur->iov_base) + written;
+            cur->iov_len -= written;
+        }
+    }
+    used_ = 0;
+    return true;
+}
+
+namespace {
+    // fills as much of buffer as the file has left; -1 on error
+    long readFull(int fd, char *buffer, size_t size) {
+        size_t done = 0;
+        while (done < size) {
+            ssize_t got = ::read(fd, buffer + done, size - done);
+            if (got < 0 && errno == EINTR) continue;
+            if (got < 0) return -1;
+            if (got == 0) break;
+            done += got;
+        }
+        return static_cast<long>(done);
+    }
+}
+
+binary::FdSource::FdSource(const std::string &filename, StreamOptions options)
+    : options_(options), current_(new char[options.bufferSize]) {
+    fd_ = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    fail_ = fd_ < 0 || options.bufferSize == 0;
+    if (fail_) return;
+    ::posix_fadvise(fd_, 0, 0, POSIX_FADV_SEQUENTIAL);
+    if (options_.readAhead) {
+        next_.reset(new char[options.bufferSize]);
+        requested_ = true;
+        reader_ = std::thread(&FdSource::readAhead, this);
+    }
+}
+
+binary::FdSource::~FdSource() {
+    if (reader_.joinable()) {
+        {
+            std::lock_guard<std::mutex> lock(mutex_);
+            stop_ = true;
+        }
+        changed_.notify_all();
+        reader_.join();
+    }
+    if (fd_ >= 0) ::close(fd_);
+}
+
+void binary::FdSource::read(char *data, std::streamsize size) {
+    while (size > 0 && !fail_) {
+        if (pos_ == size_ && !refill()) {
+            fail_ = true;
+            return;
+        }
+        size_t n = std::min<size_t>(size, size_ - pos_);
+        std::memcpy(data, current_.get() + pos_, n);
+        pos_ += n;
+        data += n;
+        size -= n;
+    }
+}
+
+bool binary::FdSource::atEnd() {
+    return !fail_ && pos_ == size_ && !refill() && !fail_;
+}
+
+// makes the next block current, swapping in the read-ahead one and starting the next
+bool binary::FdSource::refill() {
+    if (fd_ < 0 || fail_) return false;
+    long got;
+    if (options_.readAhead) {
+        std::unique_lock<std::mutex> lock(mutex_);
+        if (!requested_) return false;
+        changed_.wait(lock, [this] { return ready_; });
+        got = got_;
+        ready_ = false;
+        std::swap(current_, next_);
+        // a short or failed fill was the last one
+        requested_ = got == static_cast<long>(options_.bufferSize);
+        if (requested_) changed_.notify_all();
+    } else {
+        got = readFull(fd_, current_.get(), options_.bufferSize);
+    }
+    if (got < 0) fail_ = true;
+    pos_ = 0;
+    size_ = got > 0 ? got : 0;
+    return size_ > 0;
+}
+
+// body of reader_: fills next_ each time refill() hands it back
+void binary::FdSource::readAhead() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (true) {
+        changed_.wait(lock, [this] { return stop_ || (requested_ && !ready_); });
+        if (stop_) return;
+        char *buffer = next_.get();
+        lock.unlock();
+        long got = readFull(fd_, buffer, options_.bufferSize);
+        lock.lock();
+        got_ = got;
+        ready_ = true;
+        changed_.notify_all();
+    }
+}
+
+binary::MappedFile::MappedFile(const std::string &filename, MmapOptions options) {
+    int fd = ::open(filename.c_str(), O_RDONLY | O_CLOEXEC);
+    struct stat st;
+    if (fd < 0 || ::fstat(fd, &st) != 0) {
+        if (fd >= 0) ::close(fd);
+        fail_ = true;
+        return;
+    }
+    size_ = st.st_size;
+    if (size_ > 0) {
+        void *addr = ::mmap(nullptr, size_, PROT_READ, MAP_PRIVATE, fd, 0);
+        if (addr == MAP_FAILED) {
+            fail_ = true;
+            size_ = 0;
+        } else {
+            ::madvise(addr, size_, options.sequential ? MADV_SEQUENTIAL : MADV_RANDOM);
+            if (options.willNeed) ::madvise(addr, size_, MADV_WILLNEED);
+            data_ = static_cast<const std::byte *>(addr);
+        }
+    }
+    ::close(fd);
+}
+
+binary::MappedFile::~MappedFile() {
+    if (data_ != nullptr) ::munmap(const_cast<std::byte *>(data_), size_);
+}
@@ -403,5 +403,23 @@ int main() {
         else std::cout << "}" << std::endl;
     }
 
+    std::cout << "====== Buffer Serialize Test ======" << std::endl;
+    binary::Buffer buffer;
+    m1.clear();
+    m2.clear();
+    m1[114] = "hello";
+    m1[514] = "world";
+    binary::bufferSerialize(m1, buffer);
+    std::cout << "std::map            ";
+    std::cout << "serialize: " << buffer.size() << " bytes, ";
+    binary::bufferDeserialize(m2, buffer.bytes());
+    std::cout << "deserialize: {";
+    cnt = 0;
+    for (auto it = m2.begin(); it != m2.end(); it++) {
+        std::cout << "{" << it->first << "," << it->second << "}";
+        if (++cnt != m2.size()) std::cout << ",";
+        else std::cout<< "}" << std::endl;
+    }
+
 }
 
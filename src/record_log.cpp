@@ -0,0 +1,181 @@
+#include "record_log.h"
+
+#include <array>
+#include <cerrno>
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+namespace {
+    // reflected CRC-32 (IEEE 802.3), eight table lookups per byte group
+    std::array<std::array<uint32_t, 256>, 8> makeCrcTables() {
+        std::array<std::array<uint32_t, 256>, 8> tables{};
+        for (uint32_t i = 0; i < 256; i++) {
+            uint32_t crc = i;
+            for (int k = 0; k < 8; k++) crc = (crc >> 1) ^ (0xEDB88320u & -(crc & 1));
+            tables[0][i] = crc;
+        }
+        for (uint32_t i = 0; i < 256; i++) {
+            for (int t = 1; t < 8; t++) tables[t][i] = (tables[t - 1][i] >> 8) ^ tables[0][tables[t - 1][i] & 0xff];
+        }
+        return tables;
+    }
+
+    const std::array<std::array<uint32_t, 256>, 8> crcTables = makeCrcTables();
+
+    bool writeFull(int fd, const std::byte *data, size_t size) {
+        while (size > 0) {
+            ssize_t written = ::write(fd, data, size);
+            if (written < 0 && errno == EINTR) continue;
+            if (written < 0) return false;
+            data += written;
+            size -= written;
+        }
+        return true;
+    }
+
+    constexpr size_t FRAME_HEADER = 2 * sizeof(uint32_t);
+}
+
+uint32_t binary::crc32(const void *data, size_t size, uint32_t crc) {
+    const unsigned char *bytes = static_cast<const unsigned char *>(data);
+    crc = ~crc;
+    for (; size >= 8; size -= 8, bytes += 8) {
+        uint32_t low, high;
+        std::memcpy(&low, bytes, 4);
+        std::memcpy(&high, bytes + 4, 4);
+        low ^= crc;
+        crc = crcTables[7][low & 0xff] ^ crcTables[6][(low >> 8) & 0xff] ^
+              crcTables[5][(low >> 16) & 0xff] ^ crcTables[4][low >> 24] ^
+              crcTables[3][high & 0xff] ^ crcTables[2][(high >> 8) & 0xff] ^
+              crcTables[1][(high >> 16) & 0xff] ^ crcTables[0][high >> 24];
+    }
+    for (; size > 0; size--, bytes++) crc = (crc >> 8) ^ crcTables[0][(crc ^ *bytes) & 0xff];
+    return ~crc;
+}
+
+uint32_t binary::frameCrc(const void *payload, uint32_t size) {
+    uint32_t crc = crc32(payload, size, crc32(&size, sizeof(size)));
+    return ((crc >> 15) | (crc << 17)) + 0xa282ead8u;
+}
+
+binary::RecordLog::RecordLog(const std::string &filename, LogOptions options) : options_(options) {
+    fd_ = ::open(filename.c_str(), O_RDWR | O_CREAT | O_CLOEXEC, 0644);
+    if (fd_ < 0 || !recover()) {
+        fail_ = true;
+        return;
+    }
+    if (options_.syncInterval.count() > 0) syncer_ = std::thread([this] { syncLoop(); });
+}
+
+binary::RecordLog::~RecordLog() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    stopSyncer_.notify_all();
+    if (syncer_.joinable()) syncer_.join();
+    if (fd_ < 0) return;
+    if (options_.syncRecords > 0 || options_.syncInterval.count() > 0) sync();
+    ::close(fd_);
+}
+
+// walks the frames of the mapped file, keeping the longest prefix of valid ones
+bool binary::RecordLog::recover() {
+    struct stat st;
+    if (::fstat(fd_, &st) != 0) return false;
+    size_t size = st.st_size, end = 0;
+    if (size > 0) {
+        void *addr = ::mmap(nullptr, size, PROT_READ, MAP_PRIVATE, fd_, 0);
+        if (addr == MAP_FAILED) return false;
+        ::madvise(addr, size, MADV_SEQUENTIAL);
+        const std::byte *bytes = static_cast<const std::byte *>(addr);
+        while (size - end >= FRAME_HEADER) {
+            uint32_t header[2];
+            std::memcpy(header, bytes + end, FRAME_HEADER);
+            if (header[0] > size - end - FRAME_HEADER) break;
+            if (frameCrc(bytes + end + FRAME_HEADER, header[0]) != header[1]) break;
+            end += FRAME_HEADER + header[0];
+            records_++;
+        }
+        ::munmap(addr, size);
+    }
+    truncated_ = size - end;
+    if (truncated_ > 0 && (::ftruncate(fd_, end) != 0 || ::fdatasync(fd_) != 0)) return false;
+    writtenRecords_ = syncedRecords_ = records_;
+    return ::lseek(fd_, end, SEEK_SET) >= 0;
+}
+
+bool binary::RecordLog::appendBytes(std::span<const std::byte> payload) {
+    return wait(enqueue(payload));
+}
+
+uint64_t binary::RecordLog::enqueue(std::span<const std::byte> payload) {
+    if (payload.size() > UINT32_MAX) return 0;
+    uint32_t size = static_cast<uint32_t>(payload.size());
+    uint32_t header[2] = {size, frameCrc(payload.data(), size)};
+    std::lock_guard<std::mutex> lock(mutex_);
+    if (fd_ < 0 || fail_) return 0;
+    pending_.write(reinterpret_cast<const char *>(header), sizeof(header));
+    pending_.write(reinterpret_cast<const char *>(payload.data()), payload.size());
+    return ++records_;
+}
+
+bool binary::RecordLog::wait(uint64_t ticket) {
+    if (ticket == 0) return false;
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (writtenRecords_ < ticket && !fail_) {
+        if (writing_) written_.wait(lock);
+        else writeBatch(lock);
+    }
+    return !fail_;
+}
+
+// called with the lock held by the thread that becomes the writer; others keep queueing
+bool binary::RecordLog::writeBatch(std::unique_lock<std::mutex> &lock) {
+    writing_ = true;
+    std::swap(pending_, batch_);
+    uint64_t last = records_;
+    bool sync = options_.syncRecords > 0 && last - syncedRecords_ >= options_.syncRecords;
+    lock.unlock();
+    bool ok = writeFull(fd_, batch_.data(), batch_.size());
+    if (ok && sync) ok = ::fdatasync(fd_) == 0;
+    batch_.clear();
+    lock.lock();
+    writing_ = false;
+    if (!ok) fail_ = true;
+    writtenRecords_ = last;
+    if (ok && sync) syncedRecords_ = last;
+    written_.notify_all();
+    return ok;
+}
+
+bool binary::RecordLog::sync() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (fd_ < 0 || fail_) return false;
+    while (writing_) written_.wait(lock);
+    if (pending_.size() > 0) writeBatch(lock);
+    uint64_t written = writtenRecords_;
+    if (syncedRecords_ == written) return !fail_;
+    lock.unlock();
+    bool ok = ::fdatasync(fd_) == 0;
+    lock.lock();
+    if (!ok) fail_ = true;
+    else syncedRecords_ = std::max(syncedRecords_, written);
+    return ok;
+}
+
+void binary::RecordLog::syncLoop() {
+    std::unique_lock<std::mutex> lock(mutex_);
+    while (!stop_) {
+        stopSyncer_.wait_for(lock, options_.syncInterval, [this] { return stop_; });
+        if (stop_ || syncedRecords_ == writtenRecords_) continue;
+        uint64_t written = writtenRecords_;
+        lock.unlock();
+        bool ok = ::fdatasync(fd_) == 0;
+        lock.lock();
+        if (!ok) fail_ = true;
+        else syncedRecords_ = std::max(syncedRecords_, written);
+    }
+}
@@ -0,0 +1,129 @@
+#include "task_pool.h"
+
+namespace {
+    // the pool and worker slot of the calling thread, if it is running one of its tasks
+    thread_local const binary::TaskPool *currentPool = nullptr;
+    thread_local size_t currentSlot = 0;
+
+    // failed attempts to find a task before a thread goes to sleep; short gaps between
+    // spawns are bridged by yielding, which is far cheaper than a wake-up
+    constexpr size_t IDLE_SPINS = 64;
+}
+
+binary::TaskPool::TaskPool(size_t threads) {
+    threads = std::max<size_t>(1, threads);
+    for (size_t i = 0; i < threads; i++) workers_.push_back(std::make_unique<Worker>());
+    for (size_t i = 1; i < threads; i++) threads_.emplace_back([this, i] { loop(i); });
+}
+
+binary::TaskPool::~TaskPool() {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        stop_ = true;
+    }
+    wake_.notify_all();
+    for (auto &thread : threads_) thread.join();
+}
+
+void binary::TaskPool::run(const std::function<void()> &root) {
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        active_ = true;
+    }
+    wake_.notify_all();
+    currentPool = this;
+    currentSlot = 0;
+    root();
+    size_t misses = 0;
+    while (true) {
+        uint32_t seen = signal_.load();
+        if (pending_.load(std::memory_order_acquire) == 0) break;
+        if (runOne(0)) misses = 0;
+        else idle(seen, misses);
+    }
+    currentPool = nullptr;
+    {
+        std::lock_guard<std::mutex> lock(mutex_);
+        active_ = false;
+    }
+    // sends the workers sleeping on signal_ back to waiting for the next run
+    signal(true);
+}
+
+void binary::TaskPool::spawn(std::function<void()> task) {
+    Worker &worker = *workers_[currentPool == this ? currentSlot : 0];
+    pending_.fetch_add(1, std::memory_order_relaxed);
+    {
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        worker.tasks.push_back(std::move(task));
+        worker.queued.store(worker.tasks.size(), std::memory_order_relaxed);
+    }
+    signal(false);
+}
+
+bool binary::TaskPool::hungry() const {
+    if (workers_.size() == 1 || currentPool != this) return false;
+    return workers_[currentSlot]->queued.load(std::memory_order_relaxed) == 0;
+}
+
+// own tasks newest first, then the oldest task of the next worker that has one
+bool binary::TaskPool::runOne(size_t self) {
+    std::function<void()> task;
+    for (size_t k = 0; k < workers_.size() && !task; k++) {
+        Worker &worker = *workers_[(self + k) % workers_.size()];
+        if (worker.queued.load(std::memory_order_relaxed) == 0) continue;
+        std::lock_guard<std::mutex> lock(worker.mutex);
+        if (worker.tasks.empty()) continue;
+        if (k == 0) {
+            task = std::move(worker.tasks.back());
+            worker.tasks.pop_back();
+        } else {
+            task = std::move(worker.tasks.front());
+            worker.tasks.pop_front();
+        }
+        worker.queued.store(worker.tasks.size(), std::memory_order_relaxed);
+    }
+    if (!task) return false;
+    task();
+    // the thread in run() may be asleep waiting for the last one
+    if (pending_.fetch_sub(1, std::memory_order_acq_rel) == 1) signal(true);
+    return true;
+}
+
+void binary::TaskPool::loop(size_t self) {
+    currentPool = this;
+    currentSlot = self;
+    while (true) {
+        {
+            std::unique_lock<std::mutex> lock(mutex_);
+            wake_.wait(lock, [this] { return active_ || stop_; });
+            if (stop_) return;
+        }
+        size_t misses = 0;
+        while (active_.load(std::memory_order_acquire)) {
+            uint32_t seen = signal_.load();
+            if (runOne(self)) misses = 0;
+            else if (active_.load(std::memory_order_acquire)) idle(seen, misses);
+        }
+    }
+}
+
+// after a failed runOne: yields for a while, then sleeps until signal_ moves past seen.
+// A signal() racing with the sleep either sees the sleeper or changes signal_ first, so
+// the wait returns at once
+void binary::TaskPool::idle(uint32_t seen, size_t &misses) {
+    if (++misses < IDLE_SPINS) {
+        std::this_thread::yield();
+        return;
+    }
+    sleepers_.fetch_add(1);
+    signal_.wait(seen);
+    sleepers_.fetch_sub(1);
+}
+
+void binary::TaskPool::signal(bool all) {
+    signal_.fetch_add(1);
+    if (sleepers_.load() == 0) return;
+    if (all) signal_.notify_all();
+    else signal_.notify_one();
+}
@@ -0,0 +1,77 @@
+#include "serialize_binary.h"
+#include <cstdlib>
+#include <iostream>
+#include <list>
+#include <map>
+#include <new>
+#include <set>
+#include <string>
+#include <vector>
+
+// decoding a container must allocate exactly once per object it ends up holding: no
+// temporaries copied in, no regrowth once the length prefix is known
+
+namespace {
+    size_t allocations = 0;
+    bool counting = false;
+
+    // long enough to live on the heap rather than in the small string buffer
+    std::string text(int i) {
+        return "a heap allocated string #" + std::to_string(i);
+    }
+
+    // decoded must come back equal to expect, or to value if expect is not given
+    template <class T>
+    bool check(const char *name, const T &value, size_t expected, const T *expect = nullptr) {
+        binary::Buffer buffer;
+        binary::serialize(value, buffer);
+        T decoded;
+        binary::BufferReader reader(buffer.bytes());
+        allocations = 0;
+        counting = true;
+        binary::deserialize(decoded, reader);
+        counting = false;
+        bool ok = !reader.fail() && decoded == (expect ? *expect : value) && allocations == expected;
+        std::cout << name << ": " << allocations << " allocations, " << expected << " objects"
+                  << (ok ? "" : "  FAILED") << std::endl;
+        return ok;
+    }
+}
+
+void *operator new(size_t size) {
+    if (counting) allocations++;
+    if (void *p = std::malloc(size == 0 ? 1 : size)) return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void *p) noexcept { std::free(p); }
+void operator delete(void *p, size_t) noexcept { std::free(p); }
+
+int main() {
+    std::vector<std::string> strings;
+    for (int i = 0; i < 100; i++) strings.push_back(text(i));
+
+    std::map<int, std::vector<int>> lists;
+    for (int i = 0; i < 100; i++) lists[i] = std::vector<int>(i % 7 + 1, i);
+
+    std::vector<std::vector<std::string>> nested(10);
+    for (int i = 0; i < 10; i++) {
+        for (int j = 0; j < 10; j++) nested[i].push_back(text(i * 10 + j));
+    }
+
+    std::set<std::string> keys;
+    for (int i = 0; i < 50; i++) keys.insert(text(i));
+
+    std::list<std::string> chain;
+    for (int i = 0; i < 20; i++) chain.push_back(text(i));
+
+    bool ok = true;
+    ok &= check("std::vector<std::string> x100", strings, 1 + 100);
+    ok &= check("std::map<int, std::vector<int>> x100", lists, 100 + 100);
+    ok &= check("std::vector<std::vector<std::string>> 10x10", nested, 1 + 10 + 100);
+    ok &= check("std::set<std::string> x50", keys, 50 + 50);
+    // lists read back in reverse, as they always have
+    std::list<std::string> reversed(chain.rbegin(), chain.rend());
+    ok &= check("std::list<std::string> x20", chain, 20 + 20, &reversed);
+    return ok ? 0 : 1;
+}